@@ -1,6 +1,9 @@
 #ifndef __LIB_SYSCALL_NR_H
 #define __LIB_SYSCALL_NR_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* System call numbers. */
 enum {
 	/* Projects 2 and later. */
@@ -36,6 +39,49 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Memory management extensions. */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_MLOCK,                  /* Lock a memory range in memory. */
+	SYS_MUNLOCK,                /* Unlock a memory range. */
+	SYS_MLOCKALL,               /* Lock the whole address space. */
+	SYS_MEMSTAT,                /* Report this process's memory use. */
+	SYS_OOM_SCORE_ADJ,          /* Adjust this process's OOM badness. */
+};
+
+/* Advice for SYS_MADVISE. */
+enum {
+	MADV_NORMAL,                /* No particular pattern. */
+	MADV_RANDOM,                /* Pages will be used in random order. */
+	MADV_SEQUENTIAL,            /* Pages will be used in order. */
+	MADV_WILLNEED,              /* Pages will be needed soon. */
+	MADV_DONTNEED,              /* Pages are not needed any more. */
+	MADV_FREE,                  /* Contents may be discarded. */
+};
+
+/* For SYS_MMAP: the FD of an anonymous mapping, and a flag that
+ * may be OR'd into WRITABLE to share the mapping with children
+ * forked later instead of copying it. */
+#define MAP_ANON (-1)               /* No file: zero-filled memory. */
+#define MAP_SHARED 2                /* Shared with forked children. */
+
+/* Flags for SYS_MLOCKALL. */
+#define MCL_CURRENT 1               /* Lock pages mapped now. */
+#define MCL_FUTURE 2                /* Lock pages as they are faulted in. */
+
+/* Range of the adjustment set by SYS_OOM_SCORE_ADJ. */
+#define OOM_SCORE_ADJ_MIN (-1000)   /* Never killed for lack of memory. */
+#define OOM_SCORE_ADJ_MAX 1000      /* Killed first. */
+
+/* Filled in by SYS_MEMSTAT.  Sizes are in pages. */
+struct memstat {
+	size_t rss_anon;            /* Resident anonymous pages. */
+	size_t rss_file;            /* Resident file-backed pages. */
+	size_t rss_shared;          /* Resident pages shared with others. */
+	size_t swap;                /* Anonymous pages swapped out. */
+	size_t wss;                 /* Pages used in the last sample period. */
+	uint64_t maj_flt;           /* Faults that had to read a disk. */
+	uint64_t min_flt;           /* Faults served from memory. */
 };
 
 #endif /* lib/syscall-nr.h */
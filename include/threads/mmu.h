@@ -2,12 +2,27 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Number of pages an mmu_gather queues before it flushes. */
+#define MMU_GATHER_BATCH 32
+
+/* A batch of unmappings whose TLB invalidation, and the freeing
+ * of whatever pages they release, is deferred.  See mmu.c. */
+struct mmu_gather {
+	uint64_t *pml4;                 /* Page table being changed. */
+	uint64_t start, end;            /* Range to invalidate. */
+	size_t page_cnt;                /* Number of queued pages. */
+	void *pages[MMU_GATHER_BATCH];  /* Pages to free after flushing. */
+};
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create);
+void mmu_init (void);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
@@ -15,14 +30,26 @@ void pml4_activate (uint64_t *pml4);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
 void pml4_clear_page (uint64_t *pml4, void *upage);
+void pml4_set_writable (uint64_t *pml4, const void *upage, bool writable);
+bool pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_split_huge_page (uint64_t *pml4, void *upage);
+void pml4_clear_huge_page (uint64_t *pml4, void *upage);
+bool pml4_is_huge_page (uint64_t *pml4, const void *upage);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
+void mmu_gather_init (struct mmu_gather *, uint64_t *pml4);
+void mmu_gather_free_page (struct mmu_gather *, void *kpage);
+void mmu_gather_clear_page (struct mmu_gather *, void *upage);
+void mmu_gather_flush (struct mmu_gather *);
+void mmu_gather_finish (struct mmu_gather *);
+void pml4_clear_range (struct mmu_gather *, void *start, void *end);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
 void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
 
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
 #define is_kern_pte(pte) (!is_user_pte (pte))
+#define is_huge_pte(pte) (*(pte) & PTE_PS)
 
 #define pte_get_paddr(pte) (pg_round_down(*(pte)))
 
@@ -116,6 +116,7 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp;                     /* User rsp at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -137,6 +138,9 @@ void thread_print_stats (void);
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
 void thread_block (void);
 void thread_unblock (struct thread *);
 
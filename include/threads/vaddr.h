@@ -37,8 +37,14 @@
 /* User stack start */
 #define USER_STACK 0x47480000
 
+/* End of user virtual memory.  KERN_BASE is not 512 GB aligned,
+ * so the PML4 slot it lies in also covers the addresses just
+ * below it; that slot's page tables are shared by every address
+ * space, so those addresses are not for user pages either. */
+#define USER_LIMIT ((uint64_t) KERN_BASE & ~((1ul << 39) - 1))
+
 /* Returns true if VADDR is a user virtual address. */
-#define is_user_vaddr(vaddr) (!is_kernel_vaddr((vaddr)))
+#define is_user_vaddr(vaddr) ((uint64_t)(vaddr) < USER_LIMIT)
 
 /* Returns true if VADDR is a kernel virtual address. */
 #define is_kernel_vaddr(vaddr) ((uint64_t)(vaddr) >= KERN_BASE)
@@ -9,5 +9,6 @@ int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+bool process_load (const char *file_name, struct intr_frame *if_);
 
 #endif /* userprog/process.h */
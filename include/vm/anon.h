@@ -1,13 +1,25 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
+struct zswap_entry;
 enum vm_type;
 
+/* No swap slot. */
+#define SWAP_SLOT_NONE SIZE_MAX
+
 struct anon_page {
+	size_t slot;            /* Swap slot, or SWAP_SLOT_NONE. */
+	struct zswap_entry *zentry;  /* Compressed copy, or null. */
+	bool lazyfree;          /* May be dropped if still clean? */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_swap_readahead (struct page *page);
+void anon_discard_swap (struct page *page);
+void *do_mmap_anon (void *addr, size_t length, bool writable, bool shared);
+void anon_print_stats (void);
 
 #endif
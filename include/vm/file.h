@@ -7,6 +7,16 @@ struct page;
 enum vm_type;
 
 struct file_page {
+	struct file *file;      /* File of the mapping, or null. */
+	off_t offset;           /* Offset of the page in FILE. */
+	size_t read_bytes;      /* Bytes of the page backed by FILE. */
+};
+
+/* A dirty file-backed page taken by the flusher to write back. */
+struct wb_page {
+	struct page *page;
+	void *kva;              /* Its frame. */
+	bool ok;                /* Written back successfully? */
 };
 
 void vm_file_init (void);
@@ -14,4 +24,5 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+size_t file_write_back (struct wb_page pages[], size_t cnt);
 #endif
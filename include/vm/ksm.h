@@ -0,0 +1,23 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame;
+
+/* Number of frames ksmd scans every KSM_SCAN_MSEC milliseconds,
+ * 0 to disable merging.  Set by the -ksm kernel command-line
+ * option. */
+extern size_t ksm_pages_to_scan;
+#define KSM_SCAN_MSEC 100
+
+void ksm_init (void);
+bool ksm_enabled (void);
+uint32_t ksm_checksum (const void *kva);
+struct frame *ksm_find (uint32_t sum);
+bool ksm_insert (struct frame *frame, uint32_t sum);
+void ksm_remove (struct frame *frame);
+void ksm_print_stats (void);
+
+#endif  /* VM_KSM_H */
@@ -0,0 +1,44 @@
+#ifndef VM_OOM_H
+#define VM_OOM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct thread;
+
+/* The memory charged to a process tree: a process started by
+ * the kernel and every process forked from it, directly or
+ * not. */
+struct mem_tree {
+	int ref_cnt;            /* Processes in the tree. */
+	size_t rss;             /* Resident pages, under the frame lock. */
+	size_t swap;            /* Swap slots held, under the swap lock. */
+};
+
+/* Processes among which memory is to be found: those of TREE,
+ * or just OWNER, or all of them if both are null. */
+struct oom_scope {
+	struct thread *owner;
+	struct mem_tree *tree;
+};
+
+/* Limits on resident pages and swap slots, 0 for none.  Set by
+ * the -rss, -swapmax, -tree-rss and -tree-swap kernel
+ * command-line options. */
+extern size_t rss_limit;
+extern size_t swap_limit;
+extern size_t tree_rss_limit;
+extern size_t tree_swap_limit;
+
+void oom_init (void);
+struct mem_tree *mem_tree_create (void);
+struct mem_tree *mem_tree_get (struct mem_tree *tree);
+void mem_tree_put (struct mem_tree *tree);
+bool oom_rss_limited (size_t cnt, struct oom_scope *scope);
+bool oom_swap_allowed (struct thread *t);
+bool oom_in_scope (const struct oom_scope *scope, const struct thread *t);
+bool oom_kill (const struct oom_scope *scope);
+void oom_check (void);
+int oom_set_score_adj (int adj);
+void oom_print_stats (void);
+
+#endif  /* VM_OOM_H */
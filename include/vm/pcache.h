@@ -0,0 +1,18 @@
+#ifndef VM_PCACHE_H
+#define VM_PCACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct inode;
+
+void pcache_init (void);
+struct frame *pcache_find (struct inode *inode, off_t offset);
+bool pcache_insert (struct frame *frame, struct inode *inode, off_t offset,
+		size_t read_bytes);
+void pcache_remove (struct frame *frame);
+void pcache_invalidate (struct inode *inode, off_t offset, off_t size);
+size_t pcache_size (void);
+
+#endif  /* VM_PCACHE_H */
@@ -0,0 +1,20 @@
+#ifndef VM_SHMEM_H
+#define VM_SHMEM_H
+#include <stddef.h>
+
+struct frame;
+
+/* Anonymous memory shared by the VMAs of related processes.
+ * The frame table lock protects FRAMES. */
+struct shmem {
+	int ref_cnt;            /* Number of VMAs mapping it. */
+	size_t page_cnt;        /* Number of pages. */
+	struct frame *frames[]; /* Frame of each page, or null. */
+};
+
+void shmem_init (void);
+struct shmem *shmem_create (size_t page_cnt);
+struct shmem *shmem_get (struct shmem *shmem);
+void shmem_put (struct shmem *shmem);
+
+#endif  /* VM_SHMEM_H */
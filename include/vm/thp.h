@@ -0,0 +1,25 @@
+#ifndef VM_THP_H
+#define VM_THP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct supplemental_page_table;
+struct vma;
+
+/* Whether anonymous memory may be backed by 2 MB pages.  Set by
+ * the -thp kernel command-line option. */
+extern bool thp_enabled;
+
+/* A process looks for pages to collapse at most this often. */
+#define THP_SCAN_MSEC 1000
+
+bool thp_fault (struct vma *vma, void *va);
+bool thp_split (struct vma *vma, void *va);
+bool thp_unmap_range (struct vma *vma, void *start, void *end);
+bool thp_copy (struct vma *dst, struct vma *src);
+void thp_release (struct vma *vma);
+void thp_collapse (void);
+size_t thp_resident (struct supplemental_page_table *spt);
+void thp_print_stats (void);
+
+#endif  /* VM_THP_H */
@@ -1,5 +1,7 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <hash.h>
+#include <list.h>
 #include <stdbool.h>
 #include "threads/palloc.h"
 
@@ -31,11 +33,22 @@ enum vm_type {
 #include "filesys/page_cache.h"
 #endif
 
+struct mem_tree;
+struct memstat;
+struct mmu_gather;
 struct page_operations;
+struct shmem;
 struct thread;
+struct vma;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Marks the pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+
+/* Marks anonymous pages mapped by mmap(). */
+#define VM_MMAP VM_MARKER_1
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +59,11 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct thread *owner;  /* Process whose address space holds it. */
+	bool writable;         /* May the process write to it? */
+	bool locked;           /* Locked in memory by mlock()? */
+	bool young;            /* Accessed bit taken by the WSS sampler? */
+	struct list_elem frame_elem;  /* In its frame's list of pages. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +77,37 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * A frame may be shared, copy-on-write, by several pages, all
+ * of which are on PAGES; PAGE is the first of them. */
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list pages;      /* Pages mapping this frame. */
+	size_t map_cnt;         /* Number of pages on PAGES. */
+
+	/* Page cache (see vm/pcache.c). */
+	struct inode *inode;    /* Inode of the cached page, or null. */
+	off_t offset;           /* Offset of the page in INODE. */
+	size_t read_bytes;      /* Bytes of the page read from INODE. */
+	struct hash_elem cache_elem;
+
+	/* Samepage merging (see vm/ksm.c). */
+	uint32_t ksm_sum;       /* Checksum when last scanned. */
+	bool ksm_seen;          /* Has KSM_SUM been set? */
+	bool ksm_listed;        /* In the merging table? */
+	struct hash_elem ksm_elem;
+
+	struct shmem *shmem;    /* Shared memory owning it, or null. */
+
+	struct list_elem all_elem;  /* Element in the list of all frames. */
+	struct list_elem elem;  /* Element in an LRU list. */
+	bool active;            /* On the active list? */
+	bool unevictable;       /* On the unevictable list? */
+	bool referenced;        /* Referenced on the last scan? */
+	bool pinned;            /* Exempt from eviction? */
+	bool evicting;          /* Being written out? */
+	bool writeback;         /* Being written back by the flusher? */
 };
 
 /* The function table for page operations.
@@ -82,11 +127,40 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * A radix tree over virtual page numbers, shaped like the
+ * hardware page tables, of the pages instantiated so far (see
+ * vm/spt.c), and a tree of the areas they are created from (see
+ * vm/vma.c). */
 struct supplemental_page_table {
+	struct spt_node *root;  /* Top-level node, or null if empty. */
+	size_t page_cnt;        /* Number of pages in the table. */
+	struct vma *vma_root;   /* Mapped areas, or null if none. */
+	size_t locked_cnt;      /* Number of pages locked by mlock(). */
+	bool mlock_future;      /* Lock pages as they are faulted in? */
+	int64_t thp_scan_tick;  /* When huge pages were last collapsed. */
+	struct mmu_gather *tlb; /* Batched unmapping under way, or null. */
+
+	/* Stack growth (see vm_stack_growth()). */
+	int64_t stack_grow_tick; /* When the stack last grew. */
+	size_t stack_chunk;     /* Pages added by its last growth. */
+
+	/* Accounting (see vm_memstat()). */
+	uint64_t maj_flt;       /* Faults that had to read a disk. */
+	uint64_t min_flt;       /* Faults served from memory. */
+	size_t wss_cnt;         /* Pages found accessed in sample WSS_GEN. */
+	unsigned wss_gen;
+
+	/* Memory limits (see vm/oom.c). */
+	struct mem_tree *tree;  /* Process tree charged, or null. */
+	size_t rss_cnt;         /* Resident pages, under the frame lock. */
+	size_t swap_cnt;        /* Swap slots held, under the swap lock. */
+	int oom_score_adj;      /* Added to the OOM killer's badness. */
+	bool oom_killed;        /* Picked by the OOM killer? */
 };
 
+/* Function called by spt_for_each() on each page. */
+typedef bool spt_action_func (struct page *page, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,8 +170,29 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct page *spt_unlink_page (struct supplemental_page_table *spt, void *va);
+struct page *spt_next_page (struct supplemental_page_table *spt, void *va);
+bool spt_for_each (struct supplemental_page_table *spt, void *start,
+		void *end, spt_action_func *action, void *aux);
+void spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end);
+
+/* Maximum number of pages a process may lock in memory.  Set
+ * by the -mlock kernel command-line option. */
+extern size_t mlock_page_limit;
+
+/* Maximum size of a process's stack, in pages.  Set by the
+ * -stack kernel command-line option; 1 MB by default. */
+extern size_t stack_page_limit;
+
+/* Print each process's memory use when it exits?  Set by the
+ * -memstat kernel command-line option. */
+extern bool memstat_verbose;
 
 void vm_init (void);
+void vm_print_stats (void);
+void vm_memstat (struct memstat *st);
+void vm_print_memstat (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,7 +201,23 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+bool vm_unmap_page (struct page *page);
+void vm_unmap_begin (struct mmu_gather *tlb);
+void vm_unmap_end (struct mmu_gather *tlb, void *start, void *end);
+struct frame *vm_detach_frame (struct page *page);
+void vm_free_frame (struct frame *frame);
+void vm_release_frame (struct page *page);
+void vm_free_shmem_frame (struct frame *frame);
+void vm_adopt_frame (struct page *page, struct frame *frame, void *kva);
+void vm_charge_rss (long delta);
+bool vm_copy_private_frame (struct page *page, void *dst);
 bool vm_claim_page (void *va);
+bool vm_fault_in (const void *uaddr, size_t size, bool write);
+bool vm_prefetch_page (struct page *page);
+void vm_invalidate_file (struct inode *inode, off_t offset, off_t size);
+bool vm_lazyfree_page (struct page *page, void *aux);
+bool vm_mlock_page (struct page *page);
+void vm_munlock_page (struct page *page);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,72 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <stdbool.h>
+#include <list.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct inode;
+struct shmem;
+
+/* A virtual memory area: a page-aligned range of a process's
+ * address space whose pages share a type, a protection and a
+ * backing store.  Mapping a range only records its VMA; the
+ * struct page for each of its pages is created on first fault.
+ *
+ * The first READ_BYTES bytes of the range come from FILE,
+ * starting at OFFSET, and the rest is zero-filled. */
+struct vma {
+	void *start;            /* First page. */
+	void *end;              /* One past the last page. */
+	enum vm_type type;      /* Type of the pages, with markers. */
+	bool writable;          /* May the process write to it? */
+	struct file *file;      /* Backing file, or null.  Owned. */
+	off_t offset;           /* Offset in FILE of START. */
+	size_t read_bytes;      /* Bytes from START backed by FILE. */
+
+	/* Readahead state. */
+	int advice;             /* MADV_NORMAL, _RANDOM or _SEQUENTIAL. */
+	void *ra_next;          /* Page after the last one read, or null. */
+	size_t ra_pages;        /* Current readahead window, in pages. */
+
+	struct shmem *shmem;    /* Shared anonymous memory, or null. */
+	struct list thps;       /* Huge pages (see vm/thp.c). */
+
+	/* AVL tree keyed on START, owned by the
+	 * supplemental_page_table. */
+	struct vma *left, *right;
+	int height;
+};
+
+/* Unmapped pages kept below a stack, between it and any other
+ * mapping, so that a stack overflow faults instead of running
+ * into the mapping. */
+#define STACK_GUARD_PAGES 16
+
+struct vma *vma_create (struct supplemental_page_table *spt,
+		void *start, void *end, enum vm_type type, bool writable,
+		struct file *file, off_t offset, size_t read_bytes);
+bool vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start);
+void vma_destroy (struct supplemental_page_table *spt, struct vma *vma);
+struct vma *vma_find (struct supplemental_page_table *spt, const void *va);
+struct vma *vma_next (struct supplemental_page_table *spt, const void *va);
+struct page *vma_new_page (struct vma *vma, void *va);
+bool vma_zero_page (struct page *page);
+bool vma_cache_key (struct page *page, struct inode **inode, off_t *offset,
+		size_t *read_bytes);
+bool vma_reads_file (struct page *page);
+bool vma_init_cached_page (struct page *page, void *kva);
+struct shmem *vma_shmem (struct page *page, size_t *idx);
+void vma_readahead (struct vma *vma, void *va);
+bool vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+void vma_kill (struct supplemental_page_table *spt);
+void vma_print_stats (void);
+int do_madvise (void *addr, size_t length, int advice);
+int do_mlock (const void *addr, size_t length, bool lock);
+int do_mlockall (int flags);
+
+#endif  /* VM_VMA_H */
@@ -0,0 +1,19 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct zswap_entry;
+
+/* Maximum number of pages in the compressed pool, 0 to disable
+ * it.  Set by the -zswap kernel command-line option. */
+extern size_t zswap_page_limit;
+
+void zswap_init (void);
+bool zswap_enabled (void);
+struct zswap_entry *zswap_store (const void *page);
+void zswap_load (struct zswap_entry *entry, void *page);
+void zswap_free (struct zswap_entry *entry);
+void zswap_print_stats (void);
+
+#endif  /* VM_ZSWAP_H */
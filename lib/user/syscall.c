@@ -155,6 +155,36 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+mlock (const void *addr, size_t length) {
+	return syscall2 (SYS_MLOCK, addr, length);
+}
+
+int
+munlock (const void *addr, size_t length) {
+	return syscall2 (SYS_MUNLOCK, addr, length);
+}
+
+int
+mlockall (int flags) {
+	return syscall1 (SYS_MLOCKALL, flags);
+}
+
+int
+memstat (struct memstat *st) {
+	return syscall1 (SYS_MEMSTAT, st);
+}
+
+int
+oom_score_adj (int adj) {
+	return syscall1 (SYS_OOM_SCORE_ADJ, adj);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
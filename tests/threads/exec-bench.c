@@ -0,0 +1,109 @@
+/* Measures the cost of exec: loading an executable into a fresh
+   address space, then faulting in every page of it.  Since
+   load() only records one VMA per segment, the first should not
+   grow with the size of the executable; the second shows the
+   work deferred until the pages are touched.
+
+   Run with "run exec-bench" in a VM kernel, with the executable
+   in the file system under the name EXEC_FILE, e.g.
+     pintos -p tests/vm/child-linear:child-linear -- -q
+       -threads-tests run exec-bench
+   Reports the average cycle count of each step. */
+
+#ifdef VM
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/vm.h"
+#include "vm/vma.h"
+
+#define EXEC_FILE "child-linear"
+#define ITER_CNT 16
+
+struct exec_result
+  {
+    struct semaphore done;
+    bool loaded;
+    uint64_t load_cycles;       /* In process_load(). */
+    uint64_t touch_cycles;      /* Faulting in every page. */
+    size_t vma_cnt;             /* VMAs after loading. */
+    size_t loaded_pages;        /* Pages instantiated by loading. */
+    size_t touched_pages;       /* Pages faulted in afterward. */
+  };
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Loads EXEC_FILE into a new thread's address space as exec
+   does, then claims every page of it.  The address space is
+   torn down as the thread exits. */
+static void
+exec_thread (void *r_)
+{
+  struct exec_result *r = r_;
+  struct supplemental_page_table *spt = &thread_current ()->spt;
+  struct intr_frame if_;
+  struct vma *vma;
+  uint64_t start;
+  void *va;
+
+  supplemental_page_table_init (spt);
+  start = rdtsc ();
+  r->loaded = process_load (EXEC_FILE, &if_);
+  r->load_cycles = rdtsc () - start;
+  if (r->loaded)
+    {
+      r->loaded_pages = spt->page_cnt;
+      start = rdtsc ();
+      for (vma = vma_next (spt, NULL); vma != NULL; vma = vma_next (spt, va))
+        {
+          r->vma_cnt++;
+          for (va = vma->start; va < vma->end; va += PGSIZE)
+            {
+              struct page *page = spt_find_page (spt, va);
+              if (page == NULL || page->frame == NULL)
+                r->touched_pages += vm_claim_page (va);
+            }
+        }
+      r->touch_cycles = rdtsc () - start;
+    }
+  sema_up (&r->done);
+}
+
+void
+test_exec_bench (void)
+{
+  uint64_t load_cycles = 0, touch_cycles = 0;
+  struct exec_result r;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      r = (struct exec_result) { .loaded = false };
+      sema_init (&r.done, 0);
+      if (thread_create ("exec-bench", PRI_DEFAULT, exec_thread, &r)
+          == TID_ERROR)
+        fail ("thread_create failed");
+      sema_down (&r.done);
+      if (!r.loaded)
+        fail ("loading %s failed", EXEC_FILE);
+      load_cycles += r.load_cycles;
+      touch_cycles += r.touch_cycles;
+    }
+
+  msg ("%s: %zu VMAs, %zu pages after load, %zu more after touching all",
+       EXEC_FILE, r.vma_cnt, r.loaded_pages, r.touched_pages);
+  msg ("load   %8llu cycles", load_cycles / ITER_CNT);
+  msg ("touch  %8llu cycles", touch_cycles / ITER_CNT);
+  pass ();
+}
+#endif /* VM */
@@ -0,0 +1,168 @@
+/* Compares the radix-tree supplemental page table against a
+   table built on lib/kernel/hash.c, for inserting, looking up
+   and walking in address order a process-like layout of pages:
+   a code and data segment near the bottom of the address space,
+   a heap above it and a stack just below USER_STACK.
+
+   Run with "run spt-bench" in a VM kernel.  Reports the average
+   cycle count of each operation. */
+
+#ifdef VM
+#include <hash.h>
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+#define PAGE_CNT 4096
+#define LOOKUP_CNT (8 * PAGE_CNT)
+
+struct hash_page
+  {
+    struct hash_elem elem;
+    struct page *page;
+  };
+
+static uint64_t
+hash_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct hash_page *p = hash_entry (e, struct hash_page, elem);
+  return hash_bytes (&p->page->va, sizeof p->page->va);
+}
+
+static bool
+hash_page_less (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return hash_entry (a, struct hash_page, elem)->page->va
+         < hash_entry (b, struct hash_page, elem)->page->va;
+}
+
+static struct page *
+hash_find_page (struct hash *h, void *va)
+{
+  struct page key_page;
+  struct hash_page key;
+  struct hash_elem *e;
+
+  key_page.va = va;
+  key.page = &key_page;
+  e = hash_find (h, &key.elem);
+  return e != NULL ? hash_entry (e, struct hash_page, elem)->page : NULL;
+}
+
+/* qsort() comparison function for an array of addresses. */
+static int
+compare_vas (const void *a_, const void *b_)
+{
+  void *const *a = a_;
+  void *const *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the address of the I'th page of the layout. */
+static void *
+page_va (int i)
+{
+  if (i < PAGE_CNT / 4)
+    return (void *) (0x400000 + (uint64_t) i * PGSIZE);
+  else if (i < PAGE_CNT * 3 / 4)
+    return (void *) (0x10000000 + (uint64_t) (i - PAGE_CNT / 4) * PGSIZE);
+  else
+    return (void *) (USER_STACK - (uint64_t) (PAGE_CNT - i) * PGSIZE);
+}
+
+static void
+report (const char *what, uint64_t radix, uint64_t hashed, int cnt)
+{
+  msg ("%-8s radix %5llu cycles/op, hash %5llu cycles/op", what,
+       radix / cnt, hashed / cnt);
+}
+
+void
+test_spt_bench (void)
+{
+  static struct page pages[PAGE_CNT];
+  static struct hash_page hash_pages[PAGE_CNT];
+  struct supplemental_page_table spt;
+  struct hash h;
+  struct hash_iterator it;
+  struct page *p;
+  uint64_t start, radix, hashed;
+  int i, found;
+
+  supplemental_page_table_init (&spt);
+  hash_init (&h, hash_page_hash, hash_page_less, NULL);
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      pages[i].va = page_va (i);
+      hash_pages[i].page = &pages[i];
+    }
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    if (!spt_insert_page (&spt, &pages[i]))
+      fail ("spt_insert_page failed");
+  radix = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    hash_insert (&h, &hash_pages[i].elem);
+  hashed = rdtsc () - start;
+  report ("insert", radix, hashed, PAGE_CNT);
+
+  random_init (0);
+  start = rdtsc ();
+  for (i = found = 0; i < LOOKUP_CNT; i++)
+    found += spt_find_page (&spt, page_va (random_ulong () % PAGE_CNT)) != NULL;
+  radix = rdtsc () - start;
+  if (found != LOOKUP_CNT)
+    fail ("radix lookups found %d of %d pages", found, LOOKUP_CNT);
+  random_init (0);
+  start = rdtsc ();
+  for (i = found = 0; i < LOOKUP_CNT; i++)
+    found += hash_find_page (&h, page_va (random_ulong () % PAGE_CNT)) != NULL;
+  hashed = rdtsc () - start;
+  if (found != LOOKUP_CNT)
+    fail ("hash lookups found %d of %d pages", found, LOOKUP_CNT);
+  report ("lookup", radix, hashed, LOOKUP_CNT);
+
+  /* A hash table can only be walked in address order by
+     collecting and sorting its elements first. */
+  start = rdtsc ();
+  for (p = spt_next_page (&spt, NULL), found = 0; p != NULL;
+       p = spt_next_page (&spt, p->va + PGSIZE))
+    found++;
+  radix = rdtsc () - start;
+  start = rdtsc ();
+  {
+    void **vas = malloc (PAGE_CNT * sizeof *vas);
+    size_t cnt = 0;
+
+    hash_first (&it, &h);
+    while (hash_next (&it))
+      vas[cnt++] = hash_entry (hash_cur (&it), struct hash_page, elem)->page->va;
+    qsort (vas, cnt, sizeof *vas, compare_vas);
+    free (vas);
+  }
+  hashed = rdtsc () - start;
+  if (found != PAGE_CNT)
+    fail ("radix walk found %d of %d pages", found, PAGE_CNT);
+  report ("walk", radix, hashed, PAGE_CNT);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    spt_unlink_page (&spt, pages[i].va);
+  hash_destroy (&h, NULL);
+  pass ();
+}
+#endif /* VM */
@@ -0,0 +1,71 @@
+/* Checks that the compressed swap pool keeps the entries it
+   holds intact as others come and go: stores A and B, which
+   share a pool page, frees A, stores C and D, and then loads B,
+   C and D back.  C must take the slot A left, not B's.
+
+   Run with "run zswap-pool" in a VM kernel. */
+
+#ifdef VM
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+#define PAGE_CNT 4
+
+/* Fills PAGE with a pattern that compresses well but differs
+   for each I. */
+static void
+fill (uint8_t *page, int i)
+{
+  memset (page, 'A' + i, PGSIZE);
+  memcpy (page + PGSIZE / 2, &i, sizeof i);
+}
+
+static void
+check_load (struct zswap_entry *entry, uint8_t *buf, int i)
+{
+  uint8_t *expect = buf + PGSIZE;
+
+  zswap_load (entry, buf);
+  fill (expect, i);
+  if (memcmp (buf, expect, PGSIZE))
+    fail ("page %c came back corrupted", 'A' + i);
+}
+
+void
+test_zswap_pool (void)
+{
+  size_t old_limit = zswap_page_limit;
+  struct zswap_entry *entries[PAGE_CNT];
+  uint8_t *pages, *buf;
+  int i;
+
+  pages = palloc_get_multiple (PAL_ASSERT, PAGE_CNT);
+  buf = palloc_get_multiple (PAL_ASSERT, 2);
+  for (i = 0; i < PAGE_CNT; i++)
+    fill (pages + i * PGSIZE, i);
+  if (zswap_page_limit < PAGE_CNT)
+    zswap_page_limit = PAGE_CNT;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      entries[i] = zswap_store (pages + i * PGSIZE);
+      if (entries[i] == NULL)
+        fail ("storing page %c failed", 'A' + i);
+      if (i == 1)
+        zswap_free (entries[0]);
+    }
+  msg ("stored A and B, freed A, stored C and D");
+
+  for (i = 1; i < PAGE_CNT; i++)
+    check_load (entries[i], buf, i);
+  msg ("loaded B, C and D intact");
+
+  zswap_page_limit = old_limit;
+  palloc_free_multiple (buf, 2);
+  palloc_free_multiple (pages, PAGE_CNT);
+  pass ();
+}
+#endif /* VM */
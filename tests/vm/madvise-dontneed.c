@@ -0,0 +1,37 @@
+/* Checks that madvise(MADV_DONTNEED) drops anonymous pages at
+   once, and that they read back as zeros afterward. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define CHUNK_PAGE_COUNT 3
+#define CHUNK_SIZE (CHUNK_PAGE_COUNT * PAGE_SIZE)
+
+static char buf[CHUNK_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+	size_t i;
+
+	msg ("write pages");
+	memset (buf, 'x', CHUNK_SIZE);
+	for (i = 0 ; i < CHUNK_PAGE_COUNT ; i++)
+		CHECK (get_phys_addr (&buf[i*PAGE_SIZE]) != 0, "check if page is loaded");
+
+	CHECK (madvise (buf + 1, PAGE_SIZE, MADV_DONTNEED) == -1,
+			"madvise misaligned address");
+	CHECK (madvise (buf, CHUNK_SIZE, 99) == -1, "madvise bad advice");
+	CHECK (madvise (buf, CHUNK_SIZE, MADV_DONTNEED) == 0, "madvise DONTNEED");
+	for (i = 0 ; i < CHUNK_PAGE_COUNT ; i++)
+		CHECK (get_phys_addr (&buf[i*PAGE_SIZE]) == 0, "check if page is dropped");
+	for (i = 0 ; i < CHUNK_SIZE ; i++)
+		if (buf[i] != 0)
+			fail ("byte %zu is %d, not 0", i, buf[i]);
+	msg ("check if pages read back as zeros");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) write pages
+(madvise-dontneed) check if page is loaded
+(madvise-dontneed) check if page is loaded
+(madvise-dontneed) check if page is loaded
+(madvise-dontneed) madvise misaligned address
+(madvise-dontneed) madvise bad advice
+(madvise-dontneed) madvise DONTNEED
+(madvise-dontneed) check if page is dropped
+(madvise-dontneed) check if page is dropped
+(madvise-dontneed) check if page is dropped
+(madvise-dontneed) check if pages read back as zeros
+(madvise-dontneed) end
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Checks that memstat() counts the anonymous pages a process
+   touches, and the faults that bring them in, and that it can
+   fill in a buffer the process has never touched. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define CHUNK_PAGE_COUNT 4
+#define CHUNK_SIZE (CHUNK_PAGE_COUNT * PAGE_SIZE)
+
+static char buf[CHUNK_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static struct memstat untouched __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+	struct memstat before, after;
+
+	CHECK (memstat (&before) == 0, "memstat");
+	memset (buf, 'x', CHUNK_SIZE);
+	CHECK (memstat (&after) == 0, "memstat after writing pages");
+	if (after.rss_anon < before.rss_anon + CHUNK_PAGE_COUNT)
+		fail ("anonymous RSS went from %zu to %zu pages",
+				before.rss_anon, after.rss_anon);
+	msg ("check anonymous RSS");
+	if (after.min_flt < before.min_flt + CHUNK_PAGE_COUNT)
+		fail ("minor faults went from %llu to %llu",
+				(unsigned long long) before.min_flt,
+				(unsigned long long) after.min_flt);
+	msg ("check minor faults");
+	CHECK (memstat (&untouched) == 0, "memstat into untouched memory");
+	if (untouched.rss_anon < after.rss_anon)
+		fail ("anonymous RSS went from %zu to %zu pages",
+				after.rss_anon, untouched.rss_anon);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(memstat) begin
+(memstat) memstat
+(memstat) memstat after writing pages
+(memstat) check anonymous RSS
+(memstat) check minor faults
+(memstat) memstat into untouched memory
+(memstat) end
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Maps anonymous memory both shared and private, and checks
+   that only the shared mapping's contents outlive
+   madvise(MADV_DONTNEED), since shared memory keeps its frames
+   for every process mapping it, and that MADV_FREE refuses
+   shared memory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SIZE (2 * PAGE_SIZE)
+
+static char *shared = (char *) 0x10000000;
+static char *private = (char *) 0x20000000;
+
+static void
+check_bytes (const char *buf, size_t size, char c)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		if (buf[i] != c)
+			fail ("byte %zu is '%c', not '%c'", i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+	CHECK (mmap (shared, SIZE, 1 | MAP_SHARED, MAP_ANON, 0) == shared,
+			"mmap shared anonymous memory");
+	CHECK (mmap (private, SIZE, 1, MAP_ANON, 0) == private,
+			"mmap private anonymous memory");
+	check_bytes (shared, SIZE, 0);
+	check_bytes (private, SIZE, 0);
+	memset (shared, 's', SIZE);
+	memset (private, 'p', SIZE);
+
+	CHECK (madvise (shared, SIZE, MADV_DONTNEED) == 0,
+			"madvise shared memory MADV_DONTNEED");
+	CHECK (madvise (private, SIZE, MADV_DONTNEED) == 0,
+			"madvise private memory MADV_DONTNEED");
+	check_bytes (shared, SIZE, 's');
+	msg ("check shared memory kept its contents");
+	check_bytes (private, SIZE, 0);
+	msg ("check private memory was zeroed");
+
+	CHECK (madvise (shared, SIZE, MADV_FREE) == -1,
+			"madvise shared memory MADV_FREE must fail");
+	munmap (shared);
+	munmap (private);
+}
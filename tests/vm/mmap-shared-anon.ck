@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shared-anon) begin
+(mmap-shared-anon) mmap shared anonymous memory
+(mmap-shared-anon) mmap private anonymous memory
+(mmap-shared-anon) madvise shared memory MADV_DONTNEED
+(mmap-shared-anon) madvise private memory MADV_DONTNEED
+(mmap-shared-anon) check shared memory kept its contents
+(mmap-shared-anon) check private memory was zeroed
+(mmap-shared-anon) madvise shared memory MADV_FREE must fail
+(mmap-shared-anon) end
+EOF
+pass;
@@ -0,0 +1,18 @@
+/* Checks that oom_score_adj() accepts adjustments in range and
+   rejects the others. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+	CHECK (oom_score_adj (OOM_SCORE_ADJ_MIN - 1) == -1,
+			"oom_score_adj below minimum");
+	CHECK (oom_score_adj (OOM_SCORE_ADJ_MAX + 1) == -1,
+			"oom_score_adj above maximum");
+	CHECK (oom_score_adj (OOM_SCORE_ADJ_MIN) == 0, "oom_score_adj minimum");
+	CHECK (oom_score_adj (OOM_SCORE_ADJ_MAX) == 0, "oom_score_adj maximum");
+	CHECK (oom_score_adj (0) == 0, "oom_score_adj zero");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(oom-score-adj) begin
+(oom-score-adj) oom_score_adj below minimum
+(oom-score-adj) oom_score_adj above maximum
+(oom-score-adj) oom_score_adj minimum
+(oom-score-adj) oom_score_adj maximum
+(oom-score-adj) oom_score_adj zero
+(oom-score-adj) end
+EOF
+pass;
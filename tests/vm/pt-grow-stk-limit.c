@@ -0,0 +1,49 @@
+/* Grows the stack a page at a time through a 512 kB object,
+   which must succeed, then touches a 2 MB object, which is
+   beyond the default 1 MB stack limit.  The process must be
+   terminated with -1 exit code. */
+
+#include <stddef.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+
+/* Writes each page of BUF, top down as a growing stack would,
+   then checks that each kept what was written. */
+static void
+touch (volatile char *buf, size_t size)
+{
+  size_t i;
+
+  for (i = size / PAGE; i-- > 0; )
+    buf[i * PAGE] = i;
+  for (i = 0; i < size / PAGE; i++)
+    if (buf[i * PAGE] != (char) i)
+      fail ("page %zu of %zu kB object changed", i, size / 1024);
+}
+
+static void __attribute__ ((noinline))
+small (void)
+{
+  char obj[512 * 1024];
+
+  touch (obj, sizeof obj);
+  msg ("512 kB object ok");
+}
+
+static void __attribute__ ((noinline))
+big (void)
+{
+  char obj[2 * 1024 * 1024];
+
+  touch (obj, sizeof obj);
+  fail ("2 MB object should have been refused");
+}
+
+void
+test_main (void)
+{
+  small ();
+  big ();
+}
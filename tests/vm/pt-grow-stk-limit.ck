@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(pt-grow-stk-limit) begin
+(pt-grow-stk-limit) 512 kB object ok
+pt-grow-stk-limit: exit(-1)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Sequential memory bandwidth over a large anonymous mapping.
+
+   Touches every byte of a 2 MB-aligned anonymous mapping, which
+   takes the page faults, then reads it back sequentially several
+   times.  Reports the cycle count of each pass.
+
+   Not a test: run it by hand, with enough memory for the mapping
+   to stay resident, once with and once without -thp, e.g.
+     pintos -m 64 ... -- -q -thp run thp-bench
+   and compare the cycle counts and the VM and THP statistics
+   printed at power off. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (8 * 1024 * 1024)
+#define READ_PASSES 4
+
+static uint64_t *buf = (uint64_t *) 0x40000000;
+
+static inline uint64_t
+rdtsc (void)
+{
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+	uint64_t start, sum = 0;
+	size_t i;
+	int pass;
+
+	CHECK (mmap (buf, SIZE, 1, MAP_ANON, 0) == buf,
+			"mmap %d MB of anonymous memory", SIZE / (1024 * 1024));
+
+	start = rdtsc ();
+	memset (buf, 1, SIZE);
+	msg ("first touch: %llu cycles", rdtsc () - start);
+
+	for (pass = 0; pass < READ_PASSES; pass++) {
+		start = rdtsc ();
+		for (i = 0; i < SIZE / sizeof *buf; i++)
+			sum += buf[i];
+		msg ("read pass %d: %llu cycles", pass, rdtsc () - start);
+	}
+	if (sum != (uint64_t) READ_PASSES * (SIZE / sizeof *buf)
+			* 0x0101010101010101ULL)
+		fail ("bad sum %llu", sum);
+	munmap (buf);
+}
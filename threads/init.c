@@ -31,6 +31,10 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/ksm.h"
+#include "vm/oom.h"
+#include "vm/thp.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -142,29 +146,56 @@ bss_init (void) {
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ * Physical memory is mapped with 2 MB pages wherever a whole,
+ * aligned 2 MB region is available and does not overlap the
+ * read-only kernel text; the rest is mapped with 4 kB pages.
+ * All kernel mappings are global, so they stay in the TLB when
+ * CR3 changes, and the page directory pointer tables made here
+ * are shared by every process's pml4 (see pml4_create()). */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
 	int perm;
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
+	/* Give each PML4 slot the direct map reaches its page directory
+	 * pointer table up front.  pml4_create() copies these slots
+	 * into every address space, so their tables are shared, and
+	 * no table may be added to a kernel slot afterward. */
+	for (uint64_t slot = PML4 (KERN_BASE);
+			slot <= PML4 (ptov (mem_end - 1)); slot++) {
+		uint64_t *pdpt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+		pml4[slot] = vtop (pdpt) | PTE_U | PTE_W | PTE_P;
+	}
+
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		if (pa % HPGSIZE == 0 && pa + HPGSIZE <= mem_end
+				&& (va + HPGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_G | PTE_P | PTE_W;
+			pa += HPGSIZE;
+			continue;
+		}
+
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	mmu_init ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -226,6 +257,28 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-zswap"))
+			zswap_page_limit = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			ksm_pages_to_scan = atoi (value);
+		else if (!strcmp (name, "-mlock"))
+			mlock_page_limit = atoi (value);
+		else if (!strcmp (name, "-stack"))
+			stack_page_limit = atoi (value);
+		else if (!strcmp (name, "-thp"))
+			thp_enabled = true;
+		else if (!strcmp (name, "-memstat"))
+			memstat_verbose = true;
+		else if (!strcmp (name, "-rss"))
+			rss_limit = atoi (value);
+		else if (!strcmp (name, "-swapmax"))
+			swap_limit = atoi (value);
+		else if (!strcmp (name, "-tree-rss"))
+			tree_rss_limit = atoi (value);
+		else if (!strcmp (name, "-tree-swap"))
+			tree_swap_limit = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -328,6 +381,18 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -zswap=COUNT       Keep up to COUNT pages of compressed swap.\n"
+			"  -ksm=COUNT         Merge identical pages, scanning COUNT every 100 ms.\n"
+			"  -mlock=COUNT       Let each process lock up to COUNT pages.\n"
+			"  -stack=COUNT       Let each process's stack grow to COUNT pages.\n"
+			"  -thp               Map anonymous memory with 2 MB pages.\n"
+			"  -memstat           Print each process's memory use as it exits.\n"
+			"  -rss=COUNT         Keep each process to COUNT resident pages.\n"
+			"  -swapmax=COUNT     Let each process use up to COUNT swap slots.\n"
+			"  -tree-rss=COUNT    Keep each process tree to COUNT resident pages.\n"
+			"  -tree-swap=COUNT   Let each process tree use up to COUNT swap slots.\n"
 #endif
 			);
 	power_off ();
@@ -362,4 +427,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -1,4 +1,5 @@
 #include "threads/malloc.h"
+#include <bitmap.h>
 #include <debug.h>
 #include <list.h>
 #include <round.h>
@@ -30,9 +31,16 @@
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   descriptor.  Blocks of up to 64 kB are carved out of "runs":
+   RUN_PAGES contiguous pages divided into CHUNK_SIZE-byte chunks,
+   with a bitmap of used chunks in the run header.  Each such
+   block is preceded by a chunk header that records its run and
+   length, so a block can grow or shrink in place when its
+   neighboring chunks are free.
+
+   Anything bigger still is handled by allocating contiguous
+   pages with the page allocator and sticking the allocation
+   size at the beginning of the allocated block's arena header. */
 
 /* Descriptor. */
 struct desc {
@@ -61,8 +69,45 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Mid-size blocks. */
+#define CHUNK_SIZE 512                          /* Allocation granule. */
+#define RUN_PAGES 32                            /* Pages in a run. */
+#define RUN_CHUNKS (RUN_PAGES * PGSIZE / CHUNK_SIZE) /* Chunks in a run. */
+#define MID_MAX (64 * 1024)                     /* Largest mid-size block. */
+
+/* Magic number for detecting run corruption. */
+#define RUN_MAGIC 0x5d2a7c31
+
+/* Run of pages for mid-size blocks.
+   Chunk 0 holds this header and the used map, so it is never
+   handed out. */
+struct run {
+	unsigned magic;             /* Always set to RUN_MAGIC. */
+	struct list_elem elem;      /* Element in run_list. */
+	size_t free_cnt;            /* Number of free chunks. */
+	struct bitmap *used_map;    /* Bitmap of used chunks. */
+};
+
+/* Header in front of every mid-size block.
+   Arena blocks always start at an offset of 8 modulo 16 within
+   their page, since the arena header is 24 bytes long and all
+   block sizes are multiples of 16, whereas a mid-size block
+   starts 16 bytes past a chunk boundary.  That is how free()
+   tells the two apart. */
+struct chunk {
+	struct run *run;            /* Owning run. */
+	size_t chunk_cnt;           /* Chunks occupied, including header. */
+};
+
+static struct list run_list;    /* Runs with at least one free chunk. */
+static struct lock run_lock;    /* Protects run_list and all runs. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *mid_malloc (size_t size);
+static void mid_free (struct chunk *);
+static bool mid_resize (struct chunk *, size_t new_size);
+static struct chunk *block_to_chunk (void *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -77,6 +122,12 @@ malloc_init (void) {
 		list_init (&d->free_list);
 		lock_init (&d->lock);
 	}
+
+	ASSERT (sizeof (struct arena) % 16 == 8);
+	ASSERT (sizeof (struct chunk) == 16);
+	ASSERT (sizeof (struct run) + bitmap_buf_size (RUN_CHUNKS) <= CHUNK_SIZE);
+	list_init (&run_list);
+	lock_init (&run_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -98,7 +149,14 @@ malloc (size_t size) {
 			break;
 	if (d == descs + desc_cnt) {
 		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
+		   Try a run first, if it fits in one. */
+		if (size <= MID_MAX - sizeof (struct chunk)) {
+			void *p = mid_malloc (size);
+			if (p != NULL)
+				return p;
+		}
+
+		/* Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
 		if (a == NULL)
@@ -166,6 +224,10 @@ calloc (size_t a, size_t b) {
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
+	struct chunk *c = block_to_chunk (block);
+	if (c != NULL)
+		return c->chunk_cnt * CHUNK_SIZE - sizeof *c;
+
 	struct block *b = block;
 	struct arena *a = block_to_arena (b);
 	struct desc *d = a->desc;
@@ -178,13 +240,19 @@ block_size (void *block) {
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+   Mid-size blocks are resized in place when the chunks that
+   follow them allow it. */
 void *
 realloc (void *old_block, size_t new_size) {
 	if (new_size == 0) {
 		free (old_block);
 		return NULL;
 	} else {
+		struct chunk *c = old_block != NULL ? block_to_chunk (old_block) : NULL;
+		if (c != NULL && mid_resize (c, new_size))
+			return old_block;
+
 		void *new_block = malloc (new_size);
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
@@ -201,6 +269,12 @@ realloc (void *old_block, size_t new_size) {
 void
 free (void *p) {
 	if (p != NULL) {
+		struct chunk *c = block_to_chunk (p);
+		if (c != NULL) {
+			mid_free (c);
+			return;
+		}
+
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
 		struct desc *d = a->desc;
@@ -266,3 +340,143 @@ arena_to_block (struct arena *a, size_t idx) {
 			+ sizeof *a
 			+ idx * a->desc->block_size);
 }
+
+/* Returns the chunk header of mid-size block P, or a null
+   pointer if P was handed out from an arena. */
+static struct chunk *
+block_to_chunk (void *p) {
+	struct chunk *c;
+
+	if (pg_ofs (p) % 16 != 0)
+		return NULL;
+
+	c = (struct chunk *) p - 1;
+	ASSERT (c->run != NULL);
+	ASSERT (c->run->magic == RUN_MAGIC);
+	ASSERT (c->chunk_cnt > 0 && c->chunk_cnt < RUN_CHUNKS);
+	return c;
+}
+
+/* Returns the index of chunk C within its run. */
+static size_t
+chunk_idx (struct chunk *c) {
+	return ((uint8_t *) c - (uint8_t *) c->run) / CHUNK_SIZE;
+}
+
+/* Allocates a SIZE-byte block from a run, creating a new run if
+   none has room.  Returns a null pointer if the page allocator
+   cannot supply a new run. */
+static void *
+mid_malloc (size_t size) {
+	size_t chunk_cnt = DIV_ROUND_UP (size + sizeof (struct chunk), CHUNK_SIZE);
+	size_t idx = BITMAP_ERROR;
+	struct list_elem *e;
+	struct run *r = NULL;
+	struct chunk *c;
+
+	lock_acquire (&run_lock);
+	for (e = list_begin (&run_list); e != list_end (&run_list);
+			e = list_next (e)) {
+		r = list_entry (e, struct run, elem);
+		if (r->free_cnt < chunk_cnt)
+			continue;
+		idx = bitmap_scan_and_flip (r->used_map, 1, chunk_cnt, false);
+		if (idx != BITMAP_ERROR)
+			break;
+	}
+
+	if (idx == BITMAP_ERROR) {
+		/* Allocate and initialize a new run. */
+		r = palloc_get_multiple (0, RUN_PAGES);
+		if (r == NULL) {
+			lock_release (&run_lock);
+			return NULL;
+		}
+		r->magic = RUN_MAGIC;
+		r->free_cnt = RUN_CHUNKS - 1;
+		r->used_map = bitmap_create_in_buf (RUN_CHUNKS, r + 1,
+				CHUNK_SIZE - sizeof *r);
+		bitmap_mark (r->used_map, 0);
+		list_push_front (&run_list, &r->elem);
+		idx = bitmap_scan_and_flip (r->used_map, 1, chunk_cnt, false);
+		ASSERT (idx != BITMAP_ERROR);
+	}
+
+	r->free_cnt -= chunk_cnt;
+	if (r->free_cnt == 0)
+		list_remove (&r->elem);
+	lock_release (&run_lock);
+
+	c = (struct chunk *) ((uint8_t *) r + idx * CHUNK_SIZE);
+	c->run = r;
+	c->chunk_cnt = chunk_cnt;
+	return c + 1;
+}
+
+/* Frees mid-size block C, and its run too if that leaves the run
+   empty. */
+static void
+mid_free (struct chunk *c) {
+	struct run *r = c->run;
+	size_t idx = chunk_idx (c);
+	size_t chunk_cnt = c->chunk_cnt;
+
+#ifndef NDEBUG
+	memset (c, 0xcc, chunk_cnt * CHUNK_SIZE);
+#endif
+
+	lock_acquire (&run_lock);
+	ASSERT (bitmap_all (r->used_map, idx, chunk_cnt));
+	bitmap_set_multiple (r->used_map, idx, chunk_cnt, false);
+	if (r->free_cnt == 0)
+		list_push_front (&run_list, &r->elem);
+	r->free_cnt += chunk_cnt;
+
+	if (r->free_cnt == RUN_CHUNKS - 1) {
+		list_remove (&r->elem);
+		palloc_free_multiple (r, RUN_PAGES);
+	}
+	lock_release (&run_lock);
+}
+
+/* Tries to resize mid-size block C in place to hold NEW_SIZE
+   bytes, claiming the chunks right after it to grow or giving
+   back its trailing chunks to shrink.  Returns true if
+   successful, false if the block has to move. */
+static bool
+mid_resize (struct chunk *c, size_t new_size) {
+	struct run *r = c->run;
+	size_t idx = chunk_idx (c);
+	size_t new_cnt;
+	bool success = true;
+
+	if (new_size > MID_MAX - sizeof *c)
+		return false;
+	new_cnt = DIV_ROUND_UP (new_size + sizeof *c, CHUNK_SIZE);
+
+	lock_acquire (&run_lock);
+	if (new_cnt > c->chunk_cnt) {
+		size_t extra = new_cnt - c->chunk_cnt;
+		size_t next = idx + c->chunk_cnt;
+
+		if (next + extra <= RUN_CHUNKS
+				&& bitmap_none (r->used_map, next, extra)) {
+			bitmap_set_multiple (r->used_map, next, extra, true);
+			r->free_cnt -= extra;
+			if (r->free_cnt == 0)
+				list_remove (&r->elem);
+			c->chunk_cnt = new_cnt;
+		} else
+			success = false;
+	} else if (new_cnt < c->chunk_cnt) {
+		size_t extra = c->chunk_cnt - new_cnt;
+
+		bitmap_set_multiple (r->used_map, idx + new_cnt, extra, false);
+		if (r->free_cnt == 0)
+			list_push_front (&run_list, &r->elem);
+		r->free_cnt += extra;
+		c->chunk_cnt = new_cnt;
+	}
+	lock_release (&run_lock);
+	return success;
+}
@@ -2,12 +2,141 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+ *
+ * With CR4.PCIDE set, every TLB entry is tagged with the PCID in
+ * the low 12 bits of CR3 at the time it was filled, and loading
+ * CR3 with CR3_NOFLUSH set keeps the entries of other PCIDs
+ * around.  A switch back to a recently run process then finds
+ * its translations still cached.
+ *
+ * PCID 0 belongs to base_pml4.  PCIDs 1 through PCID_SLOTS are
+ * handed out round-robin to user page tables as they are
+ * activated; a page table whose PCID was taken away simply gets
+ * a new one, with a flush, the next time it runs. */
+#define CR4_PGE (1 << 7)                /* Global pages enable. */
+#define CR4_PCIDE (1 << 17)             /* PCID enable. */
+#define CR3_NOFLUSH (1UL << 63)         /* Keep TLB entries on load. */
+#define CPUID_1_EDX_PGE (1 << 13)       /* Global pages supported. */
+#define CPUID_1_ECX_PCID (1 << 17)      /* PCIDs supported. */
+#define CPUID_7_EBX_INVPCID (1 << 10)   /* INVPCID supported. */
+#define INVPCID_ADDR 0                  /* Invalidate one address. */
+#define INVPCID_SINGLE 1                /* Invalidate one PCID. */
+#define PCID_SLOTS 32
+
+static bool pcid_enabled;               /* CR4.PCIDE is set. */
+static bool invpcid_enabled;            /* INVPCID is available. */
+static uint64_t *pcid_owner[PCID_SLOTS + 1]; /* Page table per PCID. */
+static unsigned pcid_next;              /* Next PCID to hand out - 1. */
+
+/* Turns on global pages and PCIDs if the CPU supports them.
+ * Must be called with base_pml4 active. */
+void
+mmu_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	if (edx & CPUID_1_EDX_PGE)
+		lcr4 (rcr4 () | CR4_PGE);
+	if (!(ecx & CPUID_1_ECX_PCID))
+		return;
+	cpuid (0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		cpuid (7, 0, &eax, &ebx, &ecx, &edx);
+		invpcid_enabled = (ebx & CPUID_7_EBX_INVPCID) != 0;
+	}
+
+	ASSERT (rcr3 () == vtop (base_pml4));
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns the PCID currently assigned to PML4, or 0 if none.
+ * Must be called with interrupts off. */
+static unsigned
+pcid_lookup (uint64_t *pml4) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	for (unsigned pcid = 1; pcid <= PCID_SLOTS; pcid++)
+		if (pcid_owner[pcid] == pml4)
+			return pcid;
+	return 0;
+}
+
+/* Returns true if PML4 is the active page table. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Invalidates the TLB entry for VA in PML4, whether or not PML4
+ * is the active page table. */
+static void
+tlb_flush_page (uint64_t *pml4, uint64_t va) {
+	if (pml4_is_active (pml4))
+		invlpg (va);
+	else if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		unsigned pcid = pcid_lookup (pml4);
+		if (pcid != 0) {
+			if (invpcid_enabled)
+				invpcid (INVPCID_ADDR, pcid, va);
+			else
+				pcid_owner[pcid] = NULL;
+		}
+		intr_set_level (old_level);
+	}
+}
+
+/* Invalidates all of PML4's TLB entries, whether or not PML4 is
+ * the active page table. */
+static void
+tlb_flush_all (uint64_t *pml4) {
+	enum intr_level old_level = intr_disable ();
+	if (pml4_is_active (pml4))
+		lcr3 (rcr3 ());
+	else if (pcid_enabled) {
+		unsigned pcid = pcid_lookup (pml4);
+		if (pcid != 0) {
+			if (invpcid_enabled)
+				invpcid (INVPCID_SINGLE, pcid, 0);
+			else
+				pcid_owner[pcid] = NULL;
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Replaces the 2 MB mapping in PDE, which covers VA, by a page
+ * table of 4 kB mappings of the same frames with the same
+ * permissions.  Returns false if the page table cannot be
+ * allocated, in which case PDE is left alone. */
+static bool
+pde_split (uint64_t *pde, const uint64_t va) {
+	uint64_t *pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+
+	uint64_t pa = PTE_ADDR (*pde) & ~HPGMASK;
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	invlpg ((uint64_t) hpg_round_down (va));
+	return true;
+}
+
+/* Returns the page table entry for VA in page directory PDP.
+ * If VA is covered by a 2 MB page, returns its page directory
+ * entry instead, unless CREATE is set, in which case the 2 MB
+ * page is split into 4 kB pages first. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +151,11 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if (pdp[idx] & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!pde_split (&pdp[idx], va))
+				return NULL;
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -55,6 +189,11 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
+/* First pml4 slot of the kernel half of every address space.
+ * User pages live in the slots below it.  The tables of the
+ * kernel slots are all made up front by paging_init(). */
+#define KERN_PML4 PML4 (KERN_BASE)
+
 /* Returns the address of the page table entry for virtual
  * address VADDR in page map level 4, pml4.
  * If PML4E does not have a page table for VADDR, behavior depends
@@ -70,6 +209,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
+				ASSERT ((uint64_t) idx < KERN_PML4);
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
 				if (new_page) {
 					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
@@ -88,15 +228,52 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in page map level 4, PML4, creating the upper
+ * level tables if CREATE is true.  Returns a null pointer if a
+ * table is missing and CREATE is false, or if memory
+ * allocation fails. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	const int idx[] = { PML4 (va), PDPE (va) };
+	uint64_t *table = pml4;
+
+	if (pml4 == NULL)
+		return NULL;
+	for (unsigned level = 0; level < sizeof idx / sizeof *idx; level++) {
+		uint64_t *e = &table[idx[level]];
+		if (!(*e & PTE_P)) {
+			if (!create)
+				return NULL;
+			ASSERT (level > 0 || (uint64_t) idx[0] < KERN_PML4);
+			uint64_t *new_page = palloc_get_page (PAL_ZERO);
+			if (new_page == NULL)
+				return NULL;
+			*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (*e));
+	}
+	return &table[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
- * allocation fails. */
+ * allocation fails.
+ * The kernel half points to the same page directory pointer
+ * tables as base_pml4, which paging_init() creates up front for
+ * all of kernel memory, so kernel mappings are shared by every
+ * process without ever being copied again.  Only the user half
+ * starts out empty and gets page tables of its own. */
 uint64_t *
 pml4_create (void) {
+	const size_t slot_cnt = PGSIZE / sizeof (uint64_t);
 	uint64_t *pml4 = palloc_get_page (0);
-	if (pml4)
-		memcpy (pml4, base_pml4, PGSIZE);
+	if (pml4) {
+		memset (pml4, 0, KERN_PML4 * sizeof *pml4);
+		memcpy (pml4 + KERN_PML4, base_pml4 + KERN_PML4,
+				(slot_cnt - KERN_PML4) * sizeof *pml4);
+	}
 	return pml4;
 }
 
@@ -122,10 +299,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				/* A 2 MB page is reported once, through its PDE. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -143,7 +328,9 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * 2 MB pages are passed to FUNC as their page directory entry,
+ * which has PTE_PS set. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -156,54 +343,100 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 }
 
 static void
-pt_destroy (uint64_t *pt) {
+pt_destroy (struct mmu_gather *tlb, uint64_t *pt) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pt[i]);
 		if (((uint64_t) pte) & PTE_P)
-			palloc_free_page ((void *) PTE_ADDR (pte));
+			mmu_gather_free_page (tlb, (void *) PTE_ADDR (pte));
 	}
-	palloc_free_page ((void *) pt);
+	mmu_gather_free_page (tlb, (void *) pt);
 }
 
 static void
-pgdir_destroy (uint64_t *pdp) {
+pgdir_destroy (struct mmu_gather *tlb, uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				palloc_free_multiple (hpg_round_down (PTE_ADDR (pte)), HPGPAGES);
+			else
+				pt_destroy (tlb, PTE_ADDR (pte));
+		}
 	}
-	palloc_free_page ((void *) pdp);
+	mmu_gather_free_page (tlb, (void *) pdp);
 }
 
 static void
-pdpe_destroy (uint64_t *pdpe) {
+pdpe_destroy (struct mmu_gather *tlb, uint64_t *pdpe) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
 		if (((uint64_t) pde) & PTE_P)
-			pgdir_destroy ((void *) PTE_ADDR (pde));
+			pgdir_destroy (tlb, (void *) PTE_ADDR (pde));
 	}
-	palloc_free_page ((void *) pdpe);
+	mmu_gather_free_page (tlb, (void *) pdpe);
 }
 
-/* Destroys pml4e, freeing all the pages it references. */
+/* Destroys pml4e, freeing all the pages it references.
+ * PML4 must not be active.  Its PCID is given up first, which
+ * retires all of its TLB entries at once, so the frames and page
+ * tables are then released in batches without any further
+ * flushing. */
 void
 pml4_destroy (uint64_t *pml4) {
+	struct mmu_gather tlb;
+
 	if (pml4 == NULL)
 		return;
 	ASSERT (pml4 != base_pml4);
+	ASSERT (!pml4_is_active (pml4));
+
+	/* Drop PML4's PCID, so that the next page table to be
+	 * allocated at the same address does not inherit its TLB
+	 * entries. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		unsigned pcid = pcid_lookup (pml4);
+		if (pcid != 0) {
+			pcid_owner[pcid] = NULL;
+			if (invpcid_enabled)
+				invpcid (INVPCID_SINGLE, pcid, 0);
+		}
+		intr_set_level (old_level);
+	}
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
+	mmu_gather_init (&tlb, pml4);
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));
-	palloc_free_page ((void *) pml4);
+		pdpe_destroy (&tlb, (void *) PTE_ADDR (pdpe));
+	mmu_gather_free_page (&tlb, (void *) pml4);
+	mmu_gather_finish (&tlb);
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs enabled, PD's cached translations
+ * survive the switch if it still owns a PCID, and so do those of
+ * the other page tables. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	if (!pcid_enabled || pml4 == NULL) {
+		lcr3 (vtop (pml4 ? pml4 : base_pml4)
+				| (pcid_enabled ? CR3_NOFLUSH : 0));
+		return;
+	}
+
+	enum intr_level old_level = intr_disable ();
+	unsigned pcid = pcid_lookup (pml4);
+	if (pcid != 0)
+		lcr3 (vtop (pml4) | pcid | CR3_NOFLUSH);
+	else {
+		/* Take over the next PCID.  Loading CR3 without
+		 * CR3_NOFLUSH discards its previous owner's entries. */
+		pcid = pcid_next++ % PCID_SLOTS + 1;
+		pcid_owner[pcid] = pml4;
+		lcr3 (vtop (pml4) | pcid);
+	}
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +449,12 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte) & ~HPGMASK)
+				+ ((uint64_t) uaddr & HPGMASK);
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -227,6 +464,7 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
  * from the user pool with palloc_get_page().
  * If WRITABLE is true, the new page is read/write;
  * otherwise it is read-only.
+ * If UPAGE lies in a 2 MB page, that page is split first.
  * Returns true if successful, false if memory allocation
  * failed. */
 bool
@@ -234,32 +472,142 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (pg_ofs (kpage) == 0);
 	ASSERT (is_user_vaddr (upage));
+	ASSERT (PML4 (upage) < KERN_PML4);
 	ASSERT (pml4 != base_pml4);
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		uint64_t old = *pte;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (old & PTE_P)
+			tlb_flush_page (pml4, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
+/* Makes the mapping of user virtual page UPAGE in PML4
+ * read/write if WRITABLE is true, read-only otherwise.  The
+ * other bits of the entry, including the dirty bit, are kept.
+ * Does nothing if UPAGE is not mapped. */
+void
+pml4_set_writable (uint64_t *pml4, const void *upage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pte != NULL && (*pte & PTE_P) != 0
+			&& ((*pte & PTE_W) != 0) != writable) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Does the work of pml4_clear_page() except for the TLB
+ * invalidation.  Returns the entry it cleared, which is a page
+ * directory entry if a whole 2 MB page went, or a null pointer
+ * if UPAGE was not mapped. */
+static uint64_t *
+clear_page (uint64_t *pml4, void *upage) {
+	uint64_t *pte, *pde = NULL;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	if (pte != NULL && (*pte & PTE_PS)) {
+		pde = pte;
+		pte = pml4e_walk (pml4, (uint64_t) upage, true);
+		if (pte == NULL)
+			pte = pde;
+	}
+
+	if (pte == NULL || (*pte & PTE_P) == 0)
+		return NULL;
+	*pte &= ~PTE_P;
+	return pte;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If it lies in a 2 MB page, that
+ * page is split so that only UPAGE goes away; should the split
+ * fail for lack of memory, the whole 2 MB page is cleared. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
-	uint64_t *pte;
-	ASSERT (pg_ofs (upage) == 0);
+	if (clear_page (pml4, upage) != NULL)
+		tlb_flush_page (pml4, (uint64_t) upage);
+}
+
+/* Maps the 2 MB user virtual page UPAGE in PML4 to the 2 MB of
+ * physical memory at kernel virtual address KPAGE with a single
+ * page directory entry.  Both addresses must be 2 MB aligned and
+ * KPAGE should be a run of HPGPAGES pages from the user pool.
+ * A page table already covering UPAGE is freed, provided none of
+ * its entries is present.  If WRITABLE is true, the page is
+ * read/write; otherwise it is read-only.
+ * Returns true if successful, false if memory allocation failed
+ * or a page of the range is already mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+	ASSERT (((uint64_t) kpage & HPGMASK) == 0);
 	ASSERT (is_user_vaddr (upage));
+	ASSERT (PML4 (upage) < KERN_PML4);
+	ASSERT (pml4 != base_pml4);
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+	uint64_t *pt = NULL;
 
-	if (pte != NULL && (*pte & PTE_P) != 0) {
-		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+	if (pde == NULL)
+		return false;
+	if ((*pde & PTE_P) && !(*pde & PTE_PS)) {
+		pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof *pt; i++)
+			if (pt[i] & PTE_P)
+				return false;
 	}
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	tlb_flush_page (pml4, (uint64_t) upage);
+	if (pt != NULL)
+		palloc_free_page (pt);
+	return true;
+}
+
+/* Splits the 2 MB page that covers UPAGE in PML4 into 4 kB
+ * pages, so that they can be unmapped or protected one by one.
+ * Returns true if successful or if UPAGE is not in a 2 MB page,
+ * false if memory allocation failed. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS))
+		return true;
+	return pde_split (pde, (uint64_t) upage);
+}
+
+/* Marks the 2 MB page at UPAGE "not present" in PML4.  UPAGE
+ * must be 2 MB aligned and need not be mapped. */
+void
+pml4_clear_huge_page (uint64_t *pml4, void *upage) {
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+
+	if (pde != NULL && (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		*pde &= ~PTE_P;
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Returns true if UPAGE in PML4 is mapped by a 2 MB page. */
+bool
+pml4_is_huge_page (uint64_t *pml4, const void *upage) {
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+	return pde != NULL && (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -283,8 +631,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -309,7 +656,152 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
+	}
+}
+
+/* Batched unmapping.
+ *
+ * Unmapping pages one at a time with pml4_clear_page() pays for
+ * a TLB invalidation per page, and a caller that frees the
+ * frame right away must do so only after that invalidation.  An
+ * mmu_gather instead records the range of addresses unmapped and
+ * the pages to free.  mmu_gather_flush() then invalidates the
+ * whole range at once, page by page if it is short or by
+ * flushing all of the page table's entries if it is long, and
+ * only afterwards gives the pages back to the page allocator in
+ * a single call. */
+
+/* Ranges of more pages than this are flushed as a whole. */
+#define MMU_GATHER_FLUSH_MAX 32
+
+/* Starts a batch of changes to PML4. */
+void
+mmu_gather_init (struct mmu_gather *tlb, uint64_t *pml4) {
+	tlb->pml4 = pml4;
+	tlb->start = UINT64_MAX;
+	tlb->end = 0;
+	tlb->page_cnt = 0;
+}
+
+/* Notes that the mappings of [START, END) changed in TLB's page
+ * table and must be invalidated before TLB's pages are freed. */
+static void
+mmu_gather_add_range (struct mmu_gather *tlb, uint64_t start, uint64_t end) {
+	if (start < tlb->start)
+		tlb->start = start;
+	if (end > tlb->end)
+		tlb->end = end;
+}
+
+/* Queues KPAGE, a page from the page allocator, to be freed once
+ * the TLB has been flushed.  Flushes right away if the batch is
+ * full. */
+void
+mmu_gather_free_page (struct mmu_gather *tlb, void *kpage) {
+	if (tlb->page_cnt == MMU_GATHER_BATCH)
+		mmu_gather_flush (tlb);
+	tlb->pages[tlb->page_cnt++] = kpage;
+}
+
+/* Invalidates the TLB entries for the range unmapped so far and
+ * frees the queued pages. */
+void
+mmu_gather_flush (struct mmu_gather *tlb) {
+	if (tlb->start < tlb->end) {
+		if ((tlb->end - tlb->start) / PGSIZE <= MMU_GATHER_FLUSH_MAX)
+			for (uint64_t va = tlb->start; va < tlb->end; va += PGSIZE)
+				tlb_flush_page (tlb->pml4, va);
+		else
+			tlb_flush_all (tlb->pml4);
+		tlb->start = UINT64_MAX;
+		tlb->end = 0;
+	}
+	palloc_free_pages (tlb->pages, tlb->page_cnt);
+	tlb->page_cnt = 0;
+}
+
+/* Like pml4_clear_page(), but leaves the TLB invalidation for
+ * UPAGE to be done along with TLB's others. */
+void
+mmu_gather_clear_page (struct mmu_gather *tlb, void *upage) {
+	uint64_t *pte = clear_page (tlb->pml4, upage);
+
+	if (pte == NULL)
+		return;
+	if (*pte & PTE_PS)
+		mmu_gather_add_range (tlb, (uint64_t) hpg_round_down (upage),
+				(uint64_t) hpg_round_down (upage) + HPGSIZE);
+	else
+		mmu_gather_add_range (tlb, (uint64_t) upage,
+				(uint64_t) upage + PGSIZE);
+}
+
+/* Ends a batch of changes, flushing whatever is left. */
+void
+mmu_gather_finish (struct mmu_gather *tlb) {
+	mmu_gather_flush (tlb);
+}
+
+/* Returns true if page table PT maps nothing. */
+static bool
+pt_is_empty (const uint64_t *pt) {
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		if (pt[i] & PTE_P)
+			return false;
+	return true;
+}
+
+/* Removes every mapping of user pages in [START, END) from TLB's
+ * page table, recording them in TLB for invalidation.  The
+ * frames themselves are left alone; queue them with
+ * mmu_gather_free_page() to free them.  Page tables that end up
+ * empty are queued for freeing.  2 MB pages wholly inside the
+ * range are removed whole, and those only partly inside it are
+ * split first.  START and END must be page aligned. */
+void
+pml4_clear_range (struct mmu_gather *tlb, void *start, void *end) {
+	uint64_t va = (uint64_t) start;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (is_user_vaddr (start) && (uint64_t) end <= USER_LIMIT);
+
+	while (va < (uint64_t) end) {
+		uint64_t next = (uint64_t) hpg_round_down (va) + HPGSIZE;
+		uint64_t stop = next < (uint64_t) end ? next : (uint64_t) end;
+		uint64_t *pde = pml4e_walk_pde (tlb->pml4, va, false);
+
+		if (pde == NULL || !(*pde & PTE_P)) {
+			va = next;
+			continue;
+		}
+
+		if (*pde & PTE_PS) {
+			if (va % HPGSIZE == 0 && stop == next) {
+				*pde = 0;
+				mmu_gather_add_range (tlb, va, stop);
+				va = next;
+				continue;
+			}
+			if (!pde_split (pde, va)) {
+				/* Out of memory: drop the whole 2 MB page. */
+				*pde = 0;
+				mmu_gather_add_range (tlb, (uint64_t) hpg_round_down (va), next);
+				va = next;
+				continue;
+			}
+		}
+
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		for (; va < stop; va += PGSIZE)
+			if (pt[PTX (va)] & PTE_P) {
+				pt[PTX (va)] = 0;
+				mmu_gather_add_range (tlb, va & ~PGMASK, va + PGSIZE);
+			}
+
+		if (pt_is_empty (pt)) {
+			*pde = 0;
+			mmu_gather_free_page (tlb, pt);
+		}
 	}
 }
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,7 @@ struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +44,7 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_adjust_free (struct pool *, long delta);
 
 /* multiboot info */
 struct multiboot_info {
@@ -250,6 +253,10 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
 	return ext_mem.end;
 }
 
@@ -268,9 +275,10 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	lock_release (&pool->lock);
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
+	if (page_idx != BITMAP_ERROR) {
 		pages = pool->base + PGSIZE * page_idx;
-	else
+		pool_adjust_free (pool, -(long) page_cnt);
+	} else
 		pages = NULL;
 
 	if (pages) {
@@ -284,6 +292,43 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Like palloc_get_multiple(), but the first page returned is
+   aligned to a multiple of ALIGN_CNT pages in physical memory,
+   e.g. HPGPAGES for a run that can back a 2 MB page.  ALIGN_CNT
+   must be a power of 2. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t pool_cnt = bitmap_size (pool->used_map);
+	size_t page_idx;
+	void *pages = NULL;
+
+	ASSERT (align_cnt > 0 && (align_cnt & (align_cnt - 1)) == 0);
+
+	lock_acquire (&pool->lock);
+	page_idx = ROUND_UP (pg_no (vtop (pool->base)), align_cnt)
+		- pg_no (vtop (pool->base));
+	for (; page_idx + page_cnt <= pool_cnt; page_idx += align_cnt)
+		if (bitmap_none (pool->used_map, page_idx, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			pages = pool->base + PGSIZE * page_idx;
+			pool_adjust_free (pool, -(long) page_cnt);
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -320,6 +365,40 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool_adjust_free (pool, page_cnt);
+}
+
+/* Frees the PAGE_CNT single pages in PAGES, which need not be
+   contiguous or even from the same pool.  This is the same as
+   palloc_free_page() on each of them, except that the pool is
+   looked up only once per run of pages from the same pool.  Like
+   palloc_free_multiple(), it does not take the pool lock. */
+void
+palloc_free_pages (void *pages[], size_t page_cnt) {
+	size_t i = 0;
+
+	while (i < page_cnt) {
+		struct pool *pool;
+
+		if (page_from_pool (&kernel_pool, pages[i]))
+			pool = &kernel_pool;
+		else if (page_from_pool (&user_pool, pages[i]))
+			pool = &user_pool;
+		else
+			NOT_REACHED ();
+
+		for (; i < page_cnt && page_from_pool (pool, pages[i]); i++) {
+			size_t page_idx = pg_no (pages[i]) - pg_no (pool->base);
+
+			ASSERT (pg_ofs (pages[i]) == 0);
+#ifndef NDEBUG
+			memset (pages[i], 0xcc, PGSIZE);
+#endif
+			ASSERT (bitmap_test (pool->used_map, page_idx));
+			bitmap_reset (pool->used_map, page_idx);
+			pool_adjust_free (pool, 1);
+		}
+	}
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +407,30 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, in the kernel pool otherwise. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	return (flags & PAL_USER ? &user_pool : &kernel_pool)->free_cnt;
+}
+
+/* Returns the number of pages in the user pool if PAL_USER is
+   set in FLAGS, in the kernel pool otherwise. */
+size_t
+palloc_page_cnt (enum palloc_flags flags) {
+	return bitmap_size ((flags & PAL_USER ? &user_pool : &kernel_pool)->used_map);
+}
+
+/* Adds DELTA to POOL's count of free pages.  Pages may be freed
+   without the pool lock held, so this is done with interrupts
+   off. */
+static void
+pool_adjust_free (struct pool *pool, long delta) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += delta;
+	intr_set_level (old_level);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
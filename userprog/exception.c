@@ -5,6 +5,9 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "intrinsic.h"
+#ifdef VM
+#include "vm/oom.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -141,9 +144,19 @@ page_fault (struct intr_frame *f) {
 	user = (f->error_code & PF_U) != 0;
 
 #ifdef VM
-	/* For project 3 and later. */
+	/* For project 3 and later.  A process picked by the OOM killer
+	   dies here rather than fault anything in, as it does if the
+	   fault could not be handled for lack of memory.  Only faults
+	   from user mode qualify: a fault taken in the kernel, say
+	   while a system call copies to a user buffer, may hold locks
+	   that exiting would never release.  The system call path
+	   checks on its way back to user mode instead. */
+	if (user)
+		oom_check ();
 	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
 		return;
+	if (user)
+		oom_check ();
 #endif
 
 	/* Count page faults. */
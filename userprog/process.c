@@ -20,6 +20,8 @@
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/oom.h"
+#include "vm/vma.h"
 #endif
 
 static void process_cleanup (void);
@@ -62,6 +64,7 @@ static void
 initd (void *f_name) {
 #ifdef VM
 	supplemental_page_table_init (&thread_current ()->spt);
+	thread_current ()->spt.tree = mem_tree_create ();
 #endif
 	// printf('sdfsfsfsdfs\n');
 	// printf('sdfsfsfsdfs\n');
@@ -281,7 +284,15 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
+#ifdef VM
+	if (memstat_verbose && curr->pml4 != NULL)
+		vm_print_memstat ();
+#endif
 	process_cleanup ();
+#ifdef VM
+	mem_tree_put (curr->spt.tree);
+	curr->spt.tree = NULL;
+#endif
 }
 
 /* Free the current process's resources. */
@@ -490,6 +501,15 @@ done:
 	return success;
 }
 
+/* Loads FILE_NAME into the current thread as exec does, without
+ * running it or passing it arguments, for measuring the cost of
+ * exec (see tests/threads/exec-bench.c).  The thread's address
+ * space is torn down when it exits. */
+bool
+process_load (const char *file_name, struct intr_frame *if_) {
+	return load (file_name, if_);
+}
+
 
 /* Checks whether PHDR describes a valid, loadable segment in
  * FILE and returns true if so, false otherwise. */
@@ -639,13 +659,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -658,8 +671,11 @@ lazy_load_segment (struct page *page, void *aux) {
  * The pages initialized by this function must be writable by the
  * user process if WRITABLE is true, read-only otherwise.
  *
+ * The segment is recorded as a single VMA; its pages are read in
+ * as they are first touched.
+ *
  * Return true if successful, false if a memory allocation error
- * or disk read error occurs. */
+ * occurs or the segment overlaps one already loaded. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
@@ -667,25 +683,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-	}
-	return true;
+	return vma_create (&thread_current ()->spt, upage,
+			upage + read_bytes + zero_bytes, VM_ANON, writable,
+			read_bytes > 0 ? file : NULL, ofs, read_bytes) != NULL;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -694,11 +694,12 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vma_create (&thread_current ()->spt, stack_bottom,
+				(void *) USER_STACK, VM_ANON | VM_STACK, true, NULL, 0, 0) != NULL
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
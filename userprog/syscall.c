@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -8,6 +9,10 @@
 #include "threads/flags.h"
 #include "intrinsic.h"
 #include "threads/init.h"
+#ifdef VM
+#include "vm/oom.h"
+#include "vm/vma.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -61,6 +66,60 @@ bool remove(const char *file)
     return filesys_remove (file);
 }
 
+#ifdef VM
+static void *mmap (void *addr, size_t length, int writable, int fd,
+                   off_t offset)
+{
+    /* There is no file descriptor table yet, so only anonymous
+     * memory can be mapped. */
+    if (fd != MAP_ANON || offset != 0)
+        return NULL;
+    return do_mmap_anon (addr, length, (writable & ~MAP_SHARED) != 0,
+                         (writable & MAP_SHARED) != 0);
+}
+
+static void munmap (void *addr)
+{
+    do_munmap (addr);
+}
+
+static int madvise (void *addr, size_t length, int advice)
+{
+    return do_madvise (addr, length, advice);
+}
+
+static int mlock (const void *addr, size_t length)
+{
+    return do_mlock (addr, length, true);
+}
+
+static int munlock (const void *addr, size_t length)
+{
+    return do_mlock (addr, length, false);
+}
+
+static int mlockall (int flags)
+{
+    return do_mlockall (flags);
+}
+
+static int memstat (struct memstat *st)
+{
+    struct memstat kst;
+
+    if (st == NULL || !vm_fault_in (st, sizeof *st, true))
+        exit (-1);
+    vm_memstat (&kst);
+    memcpy (st, &kst, sizeof kst);
+    return 0;
+}
+
+static int oom_score_adj (int adj)
+{
+    return oom_set_score_adj (adj);
+}
+#endif
+
 void
 syscall_init (void) {
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
@@ -77,6 +136,10 @@ syscall_init (void) {
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f UNUSED) {
+#ifdef VM
+	oom_check ();
+	thread_current ()->user_rsp = (void *) f->rsp;
+#endif
 	switch (f->R.rax)
 	{
 	case SYS_HALT:
@@ -91,8 +154,40 @@ syscall_handler (struct intr_frame *f UNUSED) {
 	case SYS_REMOVE:
 		f->R.rax = remove(f->R.rdi);
 		break;
+#ifdef VM
+	case SYS_MMAP:
+		f->R.rax = (uint64_t) mmap((void *) f->R.rdi, f->R.rsi, f->R.rdx,
+				f->R.r10, f->R.r8);
+		break;
+	case SYS_MUNMAP:
+		munmap((void *) f->R.rdi);
+		break;
+	case SYS_MADVISE:
+		f->R.rax = madvise((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+		break;
+	case SYS_MLOCK:
+		f->R.rax = mlock((const void *) f->R.rdi, f->R.rsi);
+		break;
+	case SYS_MUNLOCK:
+		f->R.rax = munlock((const void *) f->R.rdi, f->R.rsi);
+		break;
+	case SYS_MLOCKALL:
+		f->R.rax = mlockall(f->R.rdi);
+		break;
+	case SYS_MEMSTAT:
+		f->R.rax = memstat((struct memstat *) f->R.rdi);
+		break;
+	case SYS_OOM_SCORE_ADJ:
+		f->R.rax = oom_score_adj(f->R.rdi);
+		break;
+#endif
 	default:
 		exit(-1);
 		break;
 	}
+#ifdef VM
+	/* Picked by the OOM killer during the call, with no locks held
+	 * any more: die before returning to user mode. */
+	oom_check ();
+#endif
 }
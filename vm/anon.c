@@ -2,6 +2,18 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <bitmap.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/oom.h"
+#include "vm/shmem.h"
+#include "vm/vma.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +29,308 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Swap space.
+ *
+ * The swap disk is divided into page-sized slots, handed out in
+ * clusters of SWAP_CLUSTER contiguous, aligned slots: the
+ * allocator fills one free cluster before moving to the next,
+ * so pages evicted together land next to each other on disk,
+ * and swapping one of them back in can cheaply bring in its
+ * neighbors too.
+ *
+ * A page keeps its slot after it is swapped in, for as long as
+ * the page exists.  If it is evicted again without having been
+ * written to, the copy on disk is still good and no write is
+ * needed.
+ *
+ * If the compressed pool is enabled (see zswap.c), a page that
+ * does need writing goes there instead, and only to the disk if
+ * the pool turns it away. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define SWAP_CLUSTER 8                  /* Slots per cluster. */
+
+static struct lock swap_lock;           /* Protects the fields below. */
+static struct bitmap *swap_map;         /* Slots in use. */
+static struct page **slot_pages;        /* Page in each slot. */
+static size_t slot_cnt;                 /* Number of slots. */
+static size_t swap_cursor;              /* Next slot to try. */
+static size_t cluster_end;              /* End of the current cluster. */
+
+/* Swap statistics. */
+static uint64_t swap_out_cnt;           /* Pages written to swap. */
+static uint64_t swap_clean_cnt;         /* Evictions that needed no write. */
+static uint64_t swap_in_cnt;            /* Pages read from swap. */
+static uint64_t readahead_cnt;          /* ...of which read ahead. */
+static uint64_t zswap_in_cnt;           /* Pages loaded from zswap. */
+static uint64_t lazyfree_cnt;           /* MADV_FREE pages dropped. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	zswap_init ();
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_map = bitmap_create (slot_cnt);
+	slot_pages = calloc (slot_cnt, sizeof *slot_pages);
+	if (swap_map == NULL || slot_pages == NULL)
+		PANIC ("vm_anon_init: cannot allocate swap map");
+	swap_cursor = cluster_end = 0;
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+	anon_page->zentry = NULL;
+	anon_page->lazyfree = false;
+	return true;
+}
+
+/* Charges DELTA swap slots to the process owning SPT and to its
+ * tree.  Must be called with the swap lock held. */
+static void
+charge_swap (struct supplemental_page_table *spt, long delta) {
+	spt->swap_cnt += delta;
+	if (spt->tree != NULL)
+		spt->tree->swap += delta;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Returns a free swap slot for PAGE, or SWAP_SLOT_NONE if swap
+ * is full or PAGE's process or its tree is at its swap limit.
+ * Takes the next slot of the current cluster, or starts a new
+ * cluster at the first entirely free one.  Once no free cluster
+ * is left, any free slot will do. */
+static size_t
+swap_alloc_slot (struct page *page) {
+	size_t slot = SWAP_SLOT_NONE;
+
+	lock_acquire (&swap_lock);
+	if (!oom_swap_allowed (page->owner)) {
+		lock_release (&swap_lock);
+		return SWAP_SLOT_NONE;
+	}
+	while (swap_cursor < cluster_end && bitmap_test (swap_map, swap_cursor))
+		swap_cursor++;
+	if (swap_cursor >= cluster_end) {
+		size_t c;
+
+		for (c = 0; c + SWAP_CLUSTER <= slot_cnt; c += SWAP_CLUSTER)
+			if (bitmap_none (swap_map, c, SWAP_CLUSTER))
+				break;
+		if (c + SWAP_CLUSTER <= slot_cnt) {
+			swap_cursor = c;
+			cluster_end = c + SWAP_CLUSTER;
+		} else {
+			swap_cursor = bitmap_scan (swap_map, 0, 1, false);
+			cluster_end = swap_cursor + 1;
+		}
+	}
+	if (swap_cursor != BITMAP_ERROR) {
+		slot = swap_cursor++;
+		bitmap_mark (swap_map, slot);
+		slot_pages[slot] = page;
+		charge_swap (&page->owner->spt, 1);
+	}
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Frees swap slot SLOT. */
+static void
+swap_free_slot (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_map, slot));
+	bitmap_reset (swap_map, slot);
+	charge_swap (&slot_pages[slot]->owner->spt, -1);
+	slot_pages[slot] = NULL;
+	lock_release (&swap_lock);
+}
+
+/* Swap in the page by read contents from the swap disk.  A page
+ * that was swapped out with no copy kept, because its contents
+ * were discarded, comes back zeroed. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	disk_sector_t sector = anon_page->slot * SECTORS_PER_SLOT;
+
+	if (anon_page->zentry != NULL) {
+		zswap_load (anon_page->zentry, kva);
+		anon_page->zentry = NULL;
+		zswap_in_cnt++;
+		return true;
+	}
+	if (anon_page->slot == SWAP_SLOT_NONE) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+	for (int i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, sector + i, kva + i * DISK_SECTOR_SIZE);
+	swap_in_cnt++;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	void *kva = page->frame->kva;
+	disk_sector_t sector;
+	bool dirty;
+
+	if (swap_disk == NULL && !zswap_enabled () && !anon_page->lazyfree)
+		return false;
+
+	dirty = vm_unmap_page (page);
+	if (anon_page->lazyfree) {
+		/* Unless it was written since madvise(MADV_FREE), it
+		 * need not be kept at all. */
+		anon_page->lazyfree = false;
+		if (!dirty) {
+			lazyfree_cnt++;
+			return true;
+		}
+	}
+	if (anon_page->slot != SWAP_SLOT_NONE && !dirty) {
+		swap_clean_cnt++;
+		return true;
+	}
+
+	anon_page->zentry = zswap_store (kva);
+	if (anon_page->zentry != NULL) {
+		/* Any copy on disk is out of date now. */
+		if (anon_page->slot != SWAP_SLOT_NONE) {
+			swap_free_slot (anon_page->slot);
+			anon_page->slot = SWAP_SLOT_NONE;
+		}
+		return true;
+	}
+
+	if (anon_page->slot == SWAP_SLOT_NONE
+			&& (swap_disk == NULL
+				|| (anon_page->slot = swap_alloc_slot (page)) == SWAP_SLOT_NONE)) {
+		/* Nowhere to put it, so leave it where it is. */
+		pml4_set_page (page->owner->pml4, page->va, kva, page->writable);
+		pml4_set_dirty (page->owner->pml4, page->va, true);
+		return false;
+	}
+	sector = anon_page->slot * SECTORS_PER_SLOT;
+	for (int i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_write (swap_disk, sector + i, kva + i * DISK_SECTOR_SIZE);
+	swap_out_cnt++;
+	return true;
+}
+
+/* Called after PAGE, a page of the current process, has been
+ * swapped in.  Brings in the other pages of the current process
+ * that were swapped out to the same cluster from the same VMA,
+ * on the bet that they will be wanted soon as well. */
+void
+anon_swap_readahead (struct page *page) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (spt, page->va);
+	struct page *ahead[SWAP_CLUSTER];
+	size_t slot = page->anon.slot;
+	size_t first, cnt = 0;
+
+	if (slot == SWAP_SLOT_NONE || vma == NULL)
+		return;
+
+	first = slot - slot % SWAP_CLUSTER;
+	lock_acquire (&swap_lock);
+	for (size_t s = first; s < first + SWAP_CLUSTER && s < slot_cnt; s++) {
+		struct page *p = slot_pages[s];
+		if (p != NULL && p != page && p->owner == thread_current ()
+				&& p->frame == NULL && vma->start <= p->va && p->va < vma->end)
+			ahead[cnt++] = p;
+	}
+	lock_release (&swap_lock);
+
+	/* The pages are our own, so they cannot go away under us. */
+	for (size_t i = 0; i < cnt; i++)
+		if (vm_prefetch_page (ahead[i]))
+			readahead_cnt++;
+}
+
+/* Frees the copies of PAGE kept in swap, if any.  If PAGE is
+ * not resident, its contents are lost and it comes back zeroed.
+ * If it is, the copy could otherwise be mistaken for an up to
+ * date one once the dirty bit is no longer a guide. */
+void
+anon_discard_swap (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot != SWAP_SLOT_NONE) {
+		swap_free_slot (anon_page->slot);
+		anon_page->slot = SWAP_SLOT_NONE;
+	}
+	if (anon_page->zentry != NULL) {
+		zswap_free (anon_page->zentry);
+		anon_page->zentry = NULL;
+	}
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	if (swap_disk != NULL)
+		printf ("Swap: %"PRIu64" pages out (%"PRIu64" clean), "
+				"%"PRIu64" in (%"PRIu64" read ahead)\n",
+				swap_out_cnt, swap_clean_cnt, swap_in_cnt, readahead_cnt);
+	if (lazyfree_cnt > 0)
+		printf ("Swap: %"PRIu64" lazily freed pages dropped\n", lazyfree_cnt);
+	if (zswap_enabled ()) {
+		uint64_t in_cnt = zswap_in_cnt + swap_in_cnt;
+		printf ("zswap: %"PRIu64" of %"PRIu64" swap-ins hit (%"PRIu64"%%)\n",
+				zswap_in_cnt, in_cnt, in_cnt > 0 ? zswap_in_cnt * 100 / in_cnt : 0);
+		zswap_print_stats ();
+	}
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	vm_release_frame (page);
+	if (anon_page->slot != SWAP_SLOT_NONE)
+		swap_free_slot (anon_page->slot);
+	if (anon_page->zentry != NULL)
+		zswap_free (anon_page->zentry);
+}
+
+/* Maps LENGTH bytes of zeroed anonymous memory at ADDR.  If
+ * SHARED is true, the children the process forks from now on
+ * share the memory with it; otherwise they get copies, as with
+ * the rest of the address space.  Returns ADDR, or a null
+ * pointer on failure. */
+void *
+do_mmap_anon (void *addr, size_t length, bool writable, bool shared) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+	void *end;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| (uintptr_t) addr + length < (uintptr_t) addr)
+		return NULL;
+
+	end = pg_round_up (addr + length);
+	vma = vma_create (spt, addr, end, VM_ANON | VM_MMAP, writable, NULL, 0, 0);
+	if (vma == NULL)
+		return NULL;
+	if (shared
+			&& (vma->shmem = shmem_create ((end - addr) / PGSIZE)) == NULL) {
+		vma_destroy (spt, vma);
+		return NULL;
+	}
+	return addr;
 }
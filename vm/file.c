@@ -1,6 +1,12 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <stdlib.h>
+#include <string.h>
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/vma.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,9 +20,16 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Largest run of adjacent pages written back in one write. */
+#define WB_RUN_PAGES 8
+
+/* Holds a run of pages being written back. */
+static void *wb_buf;
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	wb_buf = palloc_get_multiple (PAL_ASSERT, WB_RUN_PAGES);
 }
 
 /* Initialize the file backed page */
@@ -25,34 +38,133 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	/* The page's initializer fills this in from its VMA. */
+	page->file = (struct file_page) { .file = NULL };
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset) != (off_t) file_page->read_bytes)
+		return false;
+	memset (kva + file_page->read_bytes, 0, PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes the contents of PAGE, held in KVA, back to its file. */
+static void
+file_backed_write_back (struct page *page, void *kva) {
+	struct file_page *file_page = &page->file;
+
+	if (file_page->file != NULL)
+		file_write_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset);
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (vm_unmap_page (page))
+		file_backed_write_back (page, page->frame->kva);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct frame *frame = vm_detach_frame (page);
+
+	if (frame != NULL) {
+		if (vm_unmap_page (page))
+			file_backed_write_back (page, frame->kva);
+		vm_free_frame (frame);
+	}
+}
+
+/* qsort() comparison function that orders struct wb_pages by
+ * file, then by offset in it. */
+static int
+wb_page_compare (const void *a_, const void *b_) {
+	const struct file_page *a = &((const struct wb_page *) a_)->page->file;
+	const struct file_page *b = &((const struct wb_page *) b_)->page->file;
+	uintptr_t a_inode = (uintptr_t) file_get_inode (a->file);
+	uintptr_t b_inode = (uintptr_t) file_get_inode (b->file);
+
+	if (a_inode != b_inode)
+		return a_inode < b_inode ? -1 : 1;
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+/* Writes the CNT pages in PAGES, taken by the flusher, back to
+ * their files.  They are written in file order, and pages that
+ * follow one another in a file go out in a single write of up
+ * to WB_RUN_PAGES pages.  Sets the OK member of each page.
+ * Returns the number of writes made. */
+size_t
+file_write_back (struct wb_page pages[], size_t cnt) {
+	size_t i, j, k, write_cnt = 0;
+
+	qsort (pages, cnt, sizeof *pages, wb_page_compare);
+	for (i = 0; i < cnt; i = j) {
+		struct file_page *first = &pages[i].page->file;
+		size_t len = 0;
+		bool ok;
+
+		for (j = i; j < cnt && j - i < WB_RUN_PAGES; j++) {
+			struct file_page *file_page = &pages[j].page->file;
+
+			if (j > i && (len % PGSIZE != 0
+						|| file_page->offset != first->offset + (off_t) len
+						|| file_get_inode (file_page->file)
+						!= file_get_inode (first->file)))
+				break;
+			memcpy (wb_buf + len, pages[j].kva, file_page->read_bytes);
+			len += file_page->read_bytes;
+		}
+
+		ok = file_write_at (first->file, wb_buf, len, first->offset)
+			== (off_t) len;
+		for (k = i; k < j; k++)
+			pages[k].ok = ok;
+		write_cnt++;
+	}
+	return write_cnt;
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	off_t file_len = file_length (file);
+	size_t read_bytes;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0 || offset >= file_len
+			|| (uintptr_t) addr + length < (uintptr_t) addr)
+		return NULL;
+
+	read_bytes = (size_t) (file_len - offset);
+	if (read_bytes > length)
+		read_bytes = length;
+	if (vma_create (&thread_current ()->spt, addr,
+				pg_round_up (addr + length), VM_FILE, writable, file, offset,
+				read_bytes) == NULL)
+		return NULL;
+	return addr;
 }
 
-/* Do the munmap */
+/* Do the munmap.  Anonymous mappings made by do_mmap_anon() are
+ * unmapped the same way. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (spt, addr);
+
+	if (vma != NULL && vma->start == addr
+			&& (VM_TYPE (vma->type) == VM_FILE || (vma->type & VM_MMAP)))
+		vma_destroy (spt, vma);
 }
@@ -0,0 +1,117 @@
+/* ksm.c: Table of frames for samepage merging.
+ *
+ * When enabled, the ksmd thread in vm/vm.c goes round the frame
+ * table looking for anonymous frames with the same contents,
+ * which it merges into one frame shared copy-on-write.  Frames
+ * it has looked at are entered here, keyed by a checksum of
+ * their contents, so that a later frame with the same checksum
+ * can find its candidate twin in constant time.
+ *
+ * The checksum is only a hint: it was taken when the frame was
+ * scanned and the frame may have been written since, so contents
+ * are compared in full before anything is merged.  The frame
+ * table lock protects the table; every function here that
+ * touches it must be called with it held. */
+
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+size_t ksm_pages_to_scan;
+
+static struct hash ksm_table;
+
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_sum;
+}
+
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_sum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_sum;
+}
+
+/* Initializes the merging table. */
+void
+ksm_init (void) {
+	if (!hash_init (&ksm_table, ksm_hash, ksm_less, NULL))
+		PANIC ("ksm_init: out of memory");
+}
+
+/* Returns true if samepage merging is in use. */
+bool
+ksm_enabled (void) {
+	return ksm_pages_to_scan > 0;
+}
+
+/* Returns a checksum of the page at KVA. */
+uint32_t
+ksm_checksum (const void *kva) {
+	const uint64_t *p = kva;
+	uint64_t sum = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		sum = (sum ^ p[i]) * 0x100000001b3ULL;
+	return sum ^ (sum >> 32);
+}
+
+/* Returns the frame in the table with checksum SUM, or a null
+ * pointer if there is none. */
+struct frame *
+ksm_find (uint32_t sum) {
+	struct frame key;
+	struct hash_elem *e;
+
+	key.ksm_sum = sum;
+	e = hash_find (&ksm_table, &key.ksm_elem);
+	return e != NULL ? hash_entry (e, struct frame, ksm_elem) : NULL;
+}
+
+/* Enters FRAME in the table under checksum SUM.  Returns false
+ * if another frame has that checksum already. */
+bool
+ksm_insert (struct frame *frame, uint32_t sum) {
+	ASSERT (!frame->ksm_listed);
+
+	frame->ksm_sum = sum;
+	if (hash_insert (&ksm_table, &frame->ksm_elem) != NULL)
+		return false;
+	frame->ksm_listed = true;
+	return true;
+}
+
+/* Takes FRAME out of the table, if it is in it. */
+void
+ksm_remove (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* Prints how many frames are shared by merging and how many
+ * pages map them, beyond the first of each: the frames saved. */
+void
+ksm_print_stats (void) {
+	struct hash_iterator i;
+	size_t shared = 0, sharing = 0;
+
+	if (!ksm_enabled ())
+		return;
+	hash_first (&i, &ksm_table);
+	while (hash_next (&i)) {
+		struct frame *frame = hash_entry (hash_cur (&i), struct frame, ksm_elem);
+		if (frame->map_cnt > 1) {
+			shared++;
+			sharing += frame->map_cnt - 1;
+		}
+	}
+	printf ("KSM: %zu frames shared, %zu pages sharing them (%zu kB saved)\n",
+			shared, sharing, sharing * PGSIZE / 1024);
+}
@@ -0,0 +1,224 @@
+/* oom.c: Memory limits and the OOM killer.
+ *
+ * Each process is charged for the pages it has resident and the
+ * swap slots it holds, and so is its process tree.  A process at
+ * its resident page limit, or whose tree is at its limit, makes
+ * room by evicting pages of its own, or of its tree, instead of
+ * taking free ones; once swap is at a limit, its pages can no
+ * longer be swapped out.
+ *
+ * When memory, or a process's or tree's share of it, is used up
+ * and nothing can be evicted, the OOM killer picks the process
+ * with the highest badness: its resident pages plus its swap
+ * slots, plus its OOM score adjustment in thousandths of the
+ * user pool.  A process whose adjustment is OOM_SCORE_ADJ_MIN is
+ * never picked.  The victim is only marked; it exits, freeing
+ * its memory, the next time it enters the kernel through a page
+ * fault or a system call. */
+
+#include "vm/oom.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/vm.h"
+
+size_t rss_limit;
+size_t swap_limit;
+size_t tree_rss_limit;
+size_t tree_swap_limit;
+
+static struct lock tree_lock;           /* Protects reference counts. */
+static uint64_t kill_cnt;               /* Processes killed. */
+
+/* Initializes memory limits. */
+void
+oom_init (void) {
+	lock_init (&tree_lock);
+}
+
+/* Returns a new process tree with one process and nothing
+ * charged to it, or a null pointer if memory is short, in which
+ * case the process is charged to no tree. */
+struct mem_tree *
+mem_tree_create (void) {
+	struct mem_tree *tree = malloc (sizeof *tree);
+
+	if (tree != NULL) {
+		tree->ref_cnt = 1;
+		tree->rss = tree->swap = 0;
+	}
+	return tree;
+}
+
+/* Adds a process to TREE and returns it.  TREE may be a null
+ * pointer. */
+struct mem_tree *
+mem_tree_get (struct mem_tree *tree) {
+	if (tree != NULL) {
+		lock_acquire (&tree_lock);
+		tree->ref_cnt++;
+		lock_release (&tree_lock);
+	}
+	return tree;
+}
+
+/* Removes a process, whose memory has all been freed, from
+ * TREE, freeing it if that was the last.  TREE may be a null
+ * pointer. */
+void
+mem_tree_put (struct mem_tree *tree) {
+	bool last;
+
+	if (tree == NULL)
+		return;
+	lock_acquire (&tree_lock);
+	last = --tree->ref_cnt == 0;
+	lock_release (&tree_lock);
+	if (last)
+		free (tree);
+}
+
+/* Returns true if CNT more resident pages would take the current
+ * process over its limit or its tree over the tree's.  If so,
+ * and SCOPE is nonnull, stores in *SCOPE the processes among
+ * which room must be made. */
+bool
+oom_rss_limited (size_t cnt, struct oom_scope *scope) {
+	struct thread *t = thread_current ();
+	struct mem_tree *tree = t->spt.tree;
+	struct oom_scope s = { NULL, NULL };
+
+	if (rss_limit > 0 && t->spt.rss_cnt + cnt > rss_limit)
+		s.owner = t;
+	else if (tree_rss_limit > 0 && tree != NULL
+			&& tree->rss + cnt > tree_rss_limit)
+		s.tree = tree;
+	else
+		return false;
+	if (scope != NULL)
+		*scope = s;
+	return true;
+}
+
+/* Returns true if T, whose swap is being charged, may have one
+ * more swap slot.  Must be called with the swap lock held. */
+bool
+oom_swap_allowed (struct thread *t) {
+	struct mem_tree *tree = t->spt.tree;
+
+	return (swap_limit == 0 || t->spt.swap_cnt < swap_limit)
+		&& (tree_swap_limit == 0 || tree == NULL
+			|| tree->swap < tree_swap_limit);
+}
+
+/* Returns true if process T is in SCOPE, which may be a null
+ * pointer to take in all processes. */
+bool
+oom_in_scope (const struct oom_scope *scope, const struct thread *t) {
+	return scope == NULL
+		|| ((scope->owner == NULL || scope->owner == t)
+			&& (scope->tree == NULL || scope->tree == t->spt.tree));
+}
+
+/* Victim selection state for oom_select(). */
+struct oom_select {
+	const struct oom_scope *scope;
+	struct thread *victim;              /* Best so far, or null. */
+	long badness;                       /* Its badness. */
+	bool dying;                         /* Is a victim still exiting? */
+};
+
+/* thread_foreach() action for oom_kill(): considers T as a
+ * victim. */
+static void
+oom_select (struct thread *t, void *sel_) {
+	struct oom_select *sel = sel_;
+	long badness;
+
+	if (t->pml4 == NULL || t->status == THREAD_DYING
+			|| !oom_in_scope (sel->scope, t))
+		return;
+	if (t->spt.oom_killed) {
+		sel->dying = true;
+		return;
+	}
+	if (t->spt.oom_score_adj == OOM_SCORE_ADJ_MIN)
+		return;
+
+	badness = (long) (t->spt.rss_cnt + t->spt.swap_cnt)
+		+ (long) t->spt.oom_score_adj * palloc_page_cnt (PAL_USER) / 1000;
+	if (sel->victim == NULL || badness > sel->badness) {
+		sel->victim = t;
+		sel->badness = badness;
+	}
+}
+
+/* Frees memory among the processes in SCOPE, which may be a null
+ * pointer for all of them, by marking the one with the highest
+ * badness to be killed.  If a process marked earlier has not
+ * finished exiting yet, nobody new is marked.  Returns true if
+ * memory should come free once the victim is gone, false if no
+ * process may be killed. */
+bool
+oom_kill (const struct oom_scope *scope) {
+	struct oom_select sel = { .scope = scope, .victim = NULL };
+	enum intr_level old_level;
+	char name[sizeof sel.victim->name];
+	size_t rss, swap;
+
+	old_level = intr_disable ();
+	thread_foreach (oom_select, &sel);
+	if (!sel.dying && sel.victim != NULL) {
+		sel.victim->spt.oom_killed = true;
+		memcpy (name, sel.victim->name, sizeof name);
+		rss = sel.victim->spt.rss_cnt;
+		swap = sel.victim->spt.swap_cnt;
+	}
+	intr_set_level (old_level);
+
+	if (sel.dying)
+		return true;
+	if (sel.victim == NULL)
+		return false;
+	printf ("OOM: killed %s (%zu pages resident, %zu swapped, badness %ld)\n",
+			name, rss, swap, sel.badness);
+	kill_cnt++;
+	return true;
+}
+
+/* Terminates the current process if the OOM killer has picked
+ * it. */
+void
+oom_check (void) {
+	struct thread *t = thread_current ();
+
+	if (t->spt.oom_killed) {
+		t->exit_status = -1;
+		printf ("%s: exit(%d)\n", thread_name (), -1);
+		thread_exit ();
+	}
+}
+
+/* Sets the current process's OOM score adjustment to ADJ.
+ * Returns 0 if successful, -1 if ADJ is out of range. */
+int
+oom_set_score_adj (int adj) {
+	if (adj < OOM_SCORE_ADJ_MIN || adj > OOM_SCORE_ADJ_MAX)
+		return -1;
+	thread_current ()->spt.oom_score_adj = adj;
+	return 0;
+}
+
+/* Prints OOM killer statistics. */
+void
+oom_print_stats (void) {
+	if (kill_cnt > 0)
+		printf ("OOM: %"PRIu64" processes killed\n", kill_cnt);
+}
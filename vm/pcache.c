@@ -0,0 +1,109 @@
+/* pcache.c: Page cache of file contents shared between processes.
+ *
+ * When several processes map the same part of the same file --
+ * most often because they run the same program -- there is no
+ * need for each to read its own copy.  A frame holding a page
+ * read from a file through a mapping that will never write to
+ * it is entered here, keyed by its inode and file offset, and
+ * later faults on that page anywhere map the same frame
+ * read-only.  Private writable mappings share it too until their
+ * first write, when the write-protect fault gives them a copy.
+ *
+ * A frame stays in the cache only while some page maps it, and
+ * leaves it as soon as it is written, evicted or freed, or the
+ * file is written over it.  The frame table lock protects the
+ * cache; every function here must be called with it held. */
+
+#include "vm/pcache.h"
+#include <debug.h>
+#include <hash.h>
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+static struct hash pcache;
+
+static uint64_t
+pcache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry (e, struct frame, cache_elem);
+	return hash_bytes (&frame->inode, sizeof frame->inode)
+		^ hash_int (frame->offset / PGSIZE);
+}
+
+static bool
+pcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, cache_elem);
+	const struct frame *b = hash_entry (b_, struct frame, cache_elem);
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->offset < b->offset;
+}
+
+/* Initializes the page cache. */
+void
+pcache_init (void) {
+	if (!hash_init (&pcache, pcache_hash, pcache_less, NULL))
+		PANIC ("pcache_init: out of memory");
+}
+
+/* Returns the cached frame holding the page at OFFSET in INODE,
+ * or a null pointer if there is none. */
+struct frame *
+pcache_find (struct inode *inode, off_t offset) {
+	struct frame key;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.offset = offset;
+	e = hash_find (&pcache, &key.cache_elem);
+	return e != NULL ? hash_entry (e, struct frame, cache_elem) : NULL;
+}
+
+/* Enters FRAME, which holds READ_BYTES bytes read from INODE at
+ * OFFSET followed by zeros, in the cache.  Returns false if
+ * another frame already holds that page. */
+bool
+pcache_insert (struct frame *frame, struct inode *inode, off_t offset,
+		size_t read_bytes) {
+	ASSERT (frame->inode == NULL);
+
+	frame->inode = inode;
+	frame->offset = offset;
+	frame->read_bytes = read_bytes;
+	if (hash_insert (&pcache, &frame->cache_elem) != NULL) {
+		frame->inode = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* Takes FRAME out of the cache, if it is in it. */
+void
+pcache_remove (struct frame *frame) {
+	if (frame->inode != NULL) {
+		hash_delete (&pcache, &frame->cache_elem);
+		frame->inode = NULL;
+	}
+}
+
+/* Takes out of the cache any frames holding the SIZE bytes at
+ * OFFSET in INODE, which are about to be written over.  Pages
+ * that already map them keep the old contents. */
+void
+pcache_invalidate (struct inode *inode, off_t offset, off_t size) {
+	off_t ofs;
+
+	if (size <= 0 || hash_empty (&pcache))
+		return;
+	for (ofs = offset - offset % PGSIZE; ofs < offset + size; ofs += PGSIZE) {
+		struct frame *frame = pcache_find (inode, ofs);
+		if (frame != NULL)
+			pcache_remove (frame);
+	}
+}
+
+/* Returns the number of frames in the cache. */
+size_t
+pcache_size (void) {
+	return hash_size (&pcache);
+}
@@ -0,0 +1,76 @@
+/* shmem.c: Shared anonymous memory.
+ *
+ * An anonymous mapping made with MAP_SHARED is not copied on
+ * fork(): the child's VMA refers to the same struct shmem as the
+ * parent's, and a fault on a page of either one maps the frame
+ * that the shmem holds for that page, creating it zeroed the
+ * first time.  Writes through any of the mappings are thus seen
+ * through all of them.
+ *
+ * The shmem owns its frames, which outlive the pages mapping
+ * them: a page unmapped by madvise() or munmap() in one process
+ * leaves its contents for the others.  There is no backing store
+ * to write them to, so the frames are kept on the unevictable
+ * list until the last VMA goes away. */
+
+#include "vm/shmem.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "vm/vm.h"
+
+static struct lock shmem_lock;          /* Protects reference counts. */
+
+/* Initializes shared anonymous memory. */
+void
+shmem_init (void) {
+	lock_init (&shmem_lock);
+}
+
+/* Returns new shared memory of PAGE_CNT pages, all zeros, with
+ * one reference, or a null pointer if memory is short. */
+struct shmem *
+shmem_create (size_t page_cnt) {
+	struct shmem *shmem;
+	size_t i;
+
+	shmem = malloc (sizeof *shmem + page_cnt * sizeof *shmem->frames);
+	if (shmem == NULL)
+		return NULL;
+	shmem->ref_cnt = 1;
+	shmem->page_cnt = page_cnt;
+	for (i = 0; i < page_cnt; i++)
+		shmem->frames[i] = NULL;
+	return shmem;
+}
+
+/* Adds a reference to SHMEM and returns it. */
+struct shmem *
+shmem_get (struct shmem *shmem) {
+	lock_acquire (&shmem_lock);
+	shmem->ref_cnt++;
+	lock_release (&shmem_lock);
+	return shmem;
+}
+
+/* Drops a reference to SHMEM, freeing it and its frames if it
+ * was the last.  No page may map them by then.  SHMEM may be a
+ * null pointer. */
+void
+shmem_put (struct shmem *shmem) {
+	bool last;
+	size_t i;
+
+	if (shmem == NULL)
+		return;
+	lock_acquire (&shmem_lock);
+	last = --shmem->ref_cnt == 0;
+	lock_release (&shmem_lock);
+	if (!last)
+		return;
+
+	for (i = 0; i < shmem->page_cnt; i++)
+		if (shmem->frames[i] != NULL)
+			vm_free_shmem_frame (shmem->frames[i]);
+	free (shmem);
+}
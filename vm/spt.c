@@ -0,0 +1,243 @@
+/* spt.c: Supplemental page table.
+ *
+ * The supplemental page table maps user virtual pages to their
+ * struct page.  It is a radix tree that mirrors the x86-64 page
+ * table hierarchy: four levels, indexed by the PML4, PDPE, PDX
+ * and PTX fields of the virtual address, of 512 slots each.  A
+ * lookup is thus four dependent loads, the same as a hardware
+ * page walk, no matter how many pages the process has.
+ *
+ * Each node starts with a one-cache-line bitmap of its occupied
+ * slots.  Walking a range in address order reads that bitmap to
+ * jump straight to the next populated slot, so copying or
+ * destroying a sparse address space costs time proportional to
+ * what is mapped, not to the size of the address space.  A node
+ * is freed as soon as its last slot is emptied. */
+
+#include "vm/vm.h"
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+#define SPT_LEVELS 4                    /* Levels in the tree. */
+#define SPT_FANOUT 512                  /* Slots per node. */
+#define SPT_BITS 9                      /* Address bits per level. */
+#define SPT_MAP_WORDS (SPT_FANOUT / 64) /* Words in a node's bitmap. */
+
+/* A node of the tree.  The slots of a leaf point to struct
+ * pages, those of any other node to the next level's nodes. */
+struct spt_node {
+	uint64_t used[SPT_MAP_WORDS];       /* Bitmap of occupied slots. */
+	size_t used_cnt;                    /* Number of occupied slots. */
+	void *slots[SPT_FANOUT];            /* Children or pages. */
+};
+
+/* Returns the index into a node at LEVEL (0 for the root) for
+ * virtual page number VPN. */
+static inline unsigned
+spt_index (uint64_t vpn, int level) {
+	return (vpn >> (SPT_BITS * (SPT_LEVELS - 1 - level))) & (SPT_FANOUT - 1);
+}
+
+static struct spt_node *
+spt_node_create (void) {
+	return calloc (1, sizeof (struct spt_node));
+}
+
+static void
+spt_node_set (struct spt_node *node, unsigned idx, void *child) {
+	ASSERT (node->slots[idx] == NULL);
+	node->slots[idx] = child;
+	node->used[idx / 64] |= 1UL << (idx % 64);
+	node->used_cnt++;
+}
+
+static void
+spt_node_clear (struct spt_node *node, unsigned idx) {
+	ASSERT (node->slots[idx] != NULL);
+	node->slots[idx] = NULL;
+	node->used[idx / 64] &= ~(1UL << (idx % 64));
+	node->used_cnt--;
+}
+
+/* Returns the first occupied slot of NODE at or after IDX, or
+ * SPT_FANOUT if there is none. */
+static unsigned
+spt_node_next (const struct spt_node *node, unsigned idx) {
+	while (idx < SPT_FANOUT) {
+		uint64_t word = node->used[idx / 64] & (~0UL << (idx % 64));
+		if (word != 0)
+			return (idx & ~63u) + __builtin_ctzll (word);
+		idx = (idx & ~63u) + 64;
+	}
+	return SPT_FANOUT;
+}
+
+/* Initialize new supplemental page table */
+void
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	spt->vma_root = NULL;
+	spt->locked_cnt = 0;
+	spt->mlock_future = false;
+	spt->thp_scan_tick = 0;
+	spt->tlb = NULL;
+	spt->stack_grow_tick = 0;
+	spt->stack_chunk = 0;
+	spt->maj_flt = spt->min_flt = 0;
+	spt->wss_cnt = 0;
+	spt->wss_gen = 0;
+	spt->tree = NULL;
+	spt->rss_cnt = spt->swap_cnt = 0;
+	spt->oom_score_adj = 0;
+	spt->oom_killed = false;
+}
+
+/* Find VA from spt and return page. On error, return NULL. */
+struct page *
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	uint64_t vpn = pg_no (va);
+	struct spt_node *node = spt->root;
+
+	for (int level = 0; node != NULL && level < SPT_LEVELS - 1; level++)
+		node = node->slots[spt_index (vpn, level)];
+	return node != NULL ? node->slots[spt_index (vpn, SPT_LEVELS - 1)] : NULL;
+}
+
+/* Insert PAGE into spt with validation. */
+bool
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	uint64_t vpn = pg_no (page->va);
+	struct spt_node **nodep = &spt->root;
+	struct spt_node *parent = NULL;
+	unsigned idx;
+
+	ASSERT (pg_ofs (page->va) == 0);
+
+	for (int level = 0; level < SPT_LEVELS; level++) {
+		if (*nodep == NULL) {
+			struct spt_node *node = spt_node_create ();
+			if (node == NULL)
+				return false;
+			if (parent != NULL)
+				spt_node_set (parent, idx, node);
+			else
+				*nodep = node;
+		}
+		parent = *nodep;
+		idx = spt_index (vpn, level);
+		nodep = (struct spt_node **) &parent->slots[idx];
+	}
+
+	if (*nodep != NULL)
+		return false;
+	spt_node_set (parent, idx, page);
+	spt->page_cnt++;
+	return true;
+}
+
+/* Removes the page at VA from SPT, freeing any nodes left
+ * empty.  Returns the page, or a null pointer if VA is not in
+ * SPT. */
+struct page *
+spt_unlink_page (struct supplemental_page_table *spt, void *va) {
+	uint64_t vpn = pg_no (va);
+	struct spt_node *path[SPT_LEVELS];
+	struct spt_node *node = spt->root;
+	struct page *page;
+
+	for (int level = 0; level < SPT_LEVELS; level++) {
+		if (node == NULL)
+			return NULL;
+		path[level] = node;
+		node = path[level]->slots[spt_index (vpn, level)];
+	}
+	page = (struct page *) node;
+	if (page == NULL)
+		return NULL;
+
+	for (int level = SPT_LEVELS - 1; level >= 0; level--) {
+		spt_node_clear (path[level], spt_index (vpn, level));
+		if (path[level]->used_cnt > 0)
+			break;
+		free (path[level]);
+		if (level == 0)
+			spt->root = NULL;
+	}
+	spt->page_cnt--;
+	return page;
+}
+
+void
+spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page *removed UNUSED = spt_unlink_page (spt, page->va);
+	ASSERT (removed == page);
+	vm_dealloc_page (page);
+}
+
+/* Returns the page in NODE, a node at LEVEL covering virtual
+ * page numbers from BASE on, with the lowest address that is at
+ * least VPN, or a null pointer if there is none. */
+static struct page *
+spt_next_in (struct spt_node *node, int level, uint64_t base, uint64_t vpn) {
+	const int shift = SPT_BITS * (SPT_LEVELS - 1 - level);
+	unsigned idx = vpn > base ? (vpn - base) >> shift : 0;
+
+	for (idx = spt_node_next (node, idx); idx < SPT_FANOUT;
+			idx = spt_node_next (node, idx + 1)) {
+		uint64_t child_base = base + ((uint64_t) idx << shift);
+		if (level == SPT_LEVELS - 1)
+			return node->slots[idx];
+
+		struct page *page = spt_next_in (node->slots[idx], level + 1,
+				child_base, vpn > child_base ? vpn : child_base);
+		if (page != NULL)
+			return page;
+	}
+	return NULL;
+}
+
+/* Returns the page in SPT with the lowest address that is at
+ * least VA, or a null pointer if there is none.  Repeated calls
+ * visit pages in address order, and since every call starts from
+ * the root, the caller is free to remove pages in between. */
+struct page *
+spt_next_page (struct supplemental_page_table *spt, void *va) {
+	if (spt->root == NULL)
+		return NULL;
+	return spt_next_in (spt->root, 0, 0, pg_no (va));
+}
+
+/* Calls ACTION on each page in SPT with an address in
+ * [START, END), in address order, stopping early if ACTION
+ * returns false.  ACTION may remove its page from SPT.  Returns
+ * false if ACTION stopped the walk, true otherwise. */
+bool
+spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_action_func *action, void *aux) {
+	struct page *page = spt_next_page (spt, start);
+
+	while (page != NULL && page->va < end) {
+		void *next = page->va + PGSIZE;
+		if (!action (page, aux))
+			return false;
+		page = spt_next_page (spt, next);
+	}
+	return true;
+}
+
+static bool
+remove_page (struct page *page, void *spt) {
+	spt_remove_page (spt, page);
+	return true;
+}
+
+/* Removes and destroys each page in SPT with an address in
+ * [START, END). */
+void
+spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	spt_for_each (spt, start, end, remove_page, spt);
+}
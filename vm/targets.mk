@@ -1,5 +1,13 @@
 vm_SRC = vm/vm.c          # Main api proxy
+vm_SRC += vm/spt.c        # Supplemental page table
+vm_SRC += vm/vma.c        # Virtual memory areas
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
+vm_SRC += vm/zswap.c      # Compressed swap cache
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/pcache.c     # Shared page cache
+vm_SRC += vm/shmem.c      # Shared anonymous memory
+vm_SRC += vm/thp.c        # Transparent huge pages
+vm_SRC += vm/ksm.c        # Samepage merging
+vm_SRC += vm/oom.c        # Memory limits and OOM killer
 vm_SRC += vm/inspect.c    # Testing utility
@@ -0,0 +1,410 @@
+/* thp.c: Transparent huge pages.
+ *
+ * Faulting in anonymous memory a page at a time costs a trap, a
+ * frame and a page table entry for every 4 kB, and leaves the
+ * TLB covering very little of it.  With the -thp option, a fault
+ * in a 2 MB-aligned stretch of a private, writable, anonymous
+ * VMA that has no pages yet gets the whole stretch at once: a 2
+ * MB run of physical memory mapped by a single page directory
+ * entry.  The rest of the stretch never faults, and one TLB
+ * entry covers all of it.
+ *
+ * A huge page has no struct page or struct frame, only an entry
+ * in its VMA's list.  Whatever needs one of its pages on its own
+ * -- creating the struct page for it, a madvise() that covers
+ * only part of it -- first splits it in place into HPGPAGES
+ * ordinary pages, each with a frame of its own.  Until then it
+ * cannot be evicted, so huge pages are handed out only while
+ * memory is plentiful.  fork() gives the child a copy of each
+ * huge page, or of its pages if there is no 2 MB run to spare.
+ *
+ * Going the other way, now and then a process looks through its
+ * anonymous VMAs for a 2 MB stretch mostly filled in with
+ * resident pages of its own and collapses it into a huge page.
+ * Nothing but the process itself may change its supplemental
+ * page table, so rather than in a kernel thread the scan runs in
+ * the process, on a page fault, at most once every
+ * THP_SCAN_MSEC. */
+
+#include "vm/thp.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/oom.h"
+#include "vm/vm.h"
+#include "vm/vma.h"
+
+bool thp_enabled;
+
+/* A stretch needs this many resident pages to be collapsed. */
+#define THP_COLLAPSE_MIN (HPGPAGES / 2)
+
+/* A huge page. */
+struct thp {
+	void *va;               /* User address, 2 MB aligned. */
+	void *kva;              /* First of its HPGPAGES frames. */
+	struct list_elem elem;  /* In its VMA's list. */
+};
+
+/* Statistics. */
+static uint64_t fault_cnt;              /* Huge pages faulted in. */
+static uint64_t fallback_cnt;           /* ...or not, for lack of memory. */
+static uint64_t split_cnt;              /* Huge pages split. */
+static uint64_t collapse_cnt;           /* Huge pages collapsed. */
+static uint64_t copy_cnt;               /* Huge pages copied by fork(). */
+static size_t thp_cnt;                  /* Huge pages mapped now. */
+
+/* Returns true if the 2 MB stretch at BASE may be a huge page of
+ * VMA: it lies within VMA, which is private, writable anonymous
+ * memory, and none of it comes from a file. */
+static bool
+thp_suitable (struct vma *vma, void *base) {
+	return VM_TYPE (vma->type) == VM_ANON && vma->writable
+		&& vma->shmem == NULL && base >= vma->start
+		&& (size_t) (vma->end - base) >= HPGSIZE
+		&& (size_t) (base - vma->start) >= vma->read_bytes;
+}
+
+/* Returns a run of HPGPAGES frames for a huge page, allocated
+ * with FLAGS, or a null pointer if memory is not plentiful:
+ * taking them must leave an eighth of the user pool free, and
+ * keep the current process within its limits. */
+static void *
+thp_alloc (enum palloc_flags flags) {
+	if (palloc_free_cnt (PAL_USER)
+			< HPGPAGES + palloc_page_cnt (PAL_USER) / 8
+			|| oom_rss_limited (HPGPAGES, NULL))
+		return NULL;
+	return palloc_get_aligned (PAL_USER | flags, HPGPAGES, HPGPAGES);
+}
+
+/* Maps KVA, a run from thp_alloc(), as a huge page of VMA at
+ * BASE in the current process, recording it in THP.  Returns
+ * false if the page tables cannot take it. */
+static bool
+thp_map (struct vma *vma, struct thp *thp, void *base, void *kva) {
+	if (!pml4_set_huge_page (thread_current ()->pml4, base, kva, true))
+		return false;
+	thp->va = base;
+	thp->kva = kva;
+	list_push_back (&vma->thps, &thp->elem);
+	vm_charge_rss (HPGPAGES);
+	thp_cnt++;
+	return true;
+}
+
+/* Unmaps THP, a huge page of the current process, and frees
+ * it. */
+static void
+thp_free (struct thp *thp) {
+	uint64_t *pml4 = thread_current ()->pml4;
+
+	if (pml4 != NULL)
+		pml4_clear_huge_page (pml4, thp->va);
+	palloc_free_multiple (thp->kva, HPGPAGES);
+	list_remove (&thp->elem);
+	free (thp);
+	vm_charge_rss (-HPGPAGES);
+	thp_cnt--;
+}
+
+/* Returns the huge page of VMA that covers VA, or a null pointer
+ * if there is none. */
+static struct thp *
+thp_find (struct vma *vma, const void *va) {
+	struct list_elem *e;
+
+	for (e = list_begin (&vma->thps); e != list_end (&vma->thps);
+			e = list_next (e)) {
+		struct thp *thp = list_entry (e, struct thp, elem);
+		if (thp->va == hpg_round_down (va))
+			return thp;
+	}
+	return NULL;
+}
+
+/* Tries to handle a fault at VA, which lies within VMA, by
+ * mapping a huge page over the stretch around it.  Returns true
+ * if successful, false if the fault should be handled as usual. */
+bool
+thp_fault (struct vma *vma, void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *base = hpg_round_down (va);
+	struct page *next;
+	struct thp *thp;
+	void *kva;
+
+	if (!thp_enabled || !thp_suitable (vma, base))
+		return false;
+	next = spt_next_page (spt, base);
+	if (next != NULL && next->va < base + HPGSIZE)
+		return false;
+
+	thp = malloc (sizeof *thp);
+	kva = thp_alloc (PAL_ZERO);
+	if (thp == NULL || kva == NULL || !thp_map (vma, thp, base, kva)) {
+		free (thp);
+		if (kva != NULL)
+			palloc_free_multiple (kva, HPGPAGES);
+		fallback_cnt++;
+		return false;
+	}
+	fault_cnt++;
+	return true;
+}
+
+/* Splits the huge page of VMA that covers VA, if any, into
+ * ordinary pages of the current process with a frame each.
+ * Returns false if memory is short, in which case nothing
+ * changes; true otherwise. */
+bool
+thp_split (struct vma *vma, void *va) {
+	struct thread *t = thread_current ();
+	struct thp *thp = thp_find (vma, va);
+	struct list frames;
+	size_t i, page_cnt;
+
+	if (thp == NULL)
+		return true;
+
+	/* Allocate the pages and their frames before touching the
+	 * page table, so that running short of kernel memory leaves
+	 * the huge page as it was.  Until they are handed out, the
+	 * frames are kept on FRAMES by their all_elem. */
+	list_init (&frames);
+	for (page_cnt = 0; page_cnt < HPGPAGES; page_cnt++) {
+		struct frame *frame = malloc (sizeof *frame);
+
+		if (frame == NULL)
+			goto fail;
+		list_push_back (&frames, &frame->all_elem);
+		if (!vm_alloc_page (vma->type, thp->va + page_cnt * PGSIZE, true))
+			goto fail;
+	}
+	if (!pml4_split_huge_page (t->pml4, thp->va))
+		goto fail;
+
+	for (i = 0; i < HPGPAGES; i++) {
+		void *upage = thp->va + i * PGSIZE;
+		struct page *page = spt_find_page (&t->spt, upage);
+		struct frame *frame = list_entry (list_pop_front (&frames),
+				struct frame, all_elem);
+
+		anon_initializer (page, VM_ANON, NULL);
+		vm_adopt_frame (page, frame, thp->kva + i * PGSIZE);
+	}
+	list_remove (&thp->elem);
+	free (thp);
+	vm_charge_rss (-HPGPAGES);
+	thp_cnt--;
+	split_cnt++;
+	return true;
+
+fail:
+	/* The pages are still uninitialized, so freeing them is all
+	 * it takes to undo vm_alloc_page(). */
+	for (i = 0; i < page_cnt; i++)
+		free (spt_unlink_page (&t->spt, thp->va + i * PGSIZE));
+	while (!list_empty (&frames))
+		free (list_entry (list_pop_front (&frames), struct frame, all_elem));
+	return false;
+}
+
+/* Prepares the huge pages of VMA that overlap [START, END) for
+ * that range to be unmapped: those wholly inside are freed, the
+ * others split.  Returns false if a huge page could not be split
+ * for lack of memory. */
+bool
+thp_unmap_range (struct vma *vma, void *start, void *end) {
+	struct list_elem *e, *next;
+	bool success = true;
+
+	for (e = list_begin (&vma->thps); e != list_end (&vma->thps); e = next) {
+		struct thp *thp = list_entry (e, struct thp, elem);
+
+		next = list_next (e);
+		if (thp->va >= end || thp->va + HPGSIZE <= start)
+			continue;
+		if (start <= thp->va && thp->va + HPGSIZE <= end)
+			thp_free (thp);
+		else if (!thp_split (vma, thp->va))
+			success = false;
+	}
+	return success;
+}
+
+/* Gives DST, a VMA of the current process just copied from SRC
+ * of its parent by fork(), a copy of each of SRC's huge pages,
+ * as ordinary pages if 2 MB of memory cannot be found.  Returns
+ * false if memory runs out. */
+bool
+thp_copy (struct vma *dst, struct vma *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (&src->thps); e != list_end (&src->thps);
+			e = list_next (e)) {
+		struct thp *thp = list_entry (e, struct thp, elem);
+		struct thp *copy = malloc (sizeof *copy);
+		void *kva = copy != NULL ? thp_alloc (0) : NULL;
+		size_t i;
+
+		if (kva != NULL && thp_map (dst, copy, thp->va, kva)) {
+			memcpy (kva, thp->kva, HPGSIZE);
+			copy_cnt++;
+			continue;
+		}
+		free (copy);
+		if (kva != NULL)
+			palloc_free_multiple (kva, HPGPAGES);
+
+		for (i = 0; i < HPGPAGES; i++) {
+			void *upage = thp->va + i * PGSIZE;
+			struct page *page;
+
+			if (!vm_alloc_page (dst->type, upage, true)
+					|| !vm_claim_page (upage))
+				return false;
+			page = spt_find_page (&thread_current ()->spt, upage);
+			memcpy (page->frame->kva, thp->kva + i * PGSIZE, PGSIZE);
+		}
+	}
+	return true;
+}
+
+/* Frees every huge page of VMA, which is going away. */
+void
+thp_release (struct vma *vma) {
+	while (!list_empty (&vma->thps))
+		thp_free (list_entry (list_front (&vma->thps), struct thp, elem));
+}
+
+/* spt_for_each() action for collapse_stretch(): checks that PAGE
+ * either would be all zeros or is resident, counting the latter
+ * in *RESIDENT. */
+static bool
+collapse_check (struct page *page, void *resident_) {
+	size_t *resident = resident_;
+
+	if (page->locked)
+		return false;
+	if (page->operations->type == VM_UNINIT)
+		return vma_zero_page (page);
+	if (page->operations->type != VM_ANON || page->frame == NULL)
+		return false;
+	++*resident;
+	return true;
+}
+
+/* Where collapse_copy() copies a stretch to. */
+struct collapse_dst {
+	void *base;             /* User address of the stretch. */
+	void *kva;              /* Kernel address of the huge page. */
+};
+
+/* spt_for_each() action for collapse_stretch(): copies PAGE, if
+ * it is resident, to its place in the huge page. */
+static bool
+collapse_copy (struct page *page, void *dst_) {
+	struct collapse_dst *dst = dst_;
+
+	if (page->operations->type == VM_UNINIT)
+		return true;
+	return vm_copy_private_frame (page, dst->kva + (page->va - dst->base));
+}
+
+/* Collapses the 2 MB stretch of VMA at BASE into a huge page, if
+ * it has enough resident pages and all of them are private to
+ * the current process.  Returns true if successful. */
+static bool
+collapse_stretch (struct vma *vma, void *base) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct collapse_dst dst;
+	struct thp *thp;
+	size_t resident = 0;
+
+	if (!spt_for_each (spt, base, base + HPGSIZE, collapse_check, &resident)
+			|| resident < THP_COLLAPSE_MIN)
+		return false;
+
+	/* Besides the huge page itself, mapping it needs the page
+	 * directory above the stretch, so make sure that exists before
+	 * anything changes and back out if it cannot be had. */
+	dst.base = base;
+	dst.kva = thp_alloc (PAL_ZERO);
+	thp = malloc (sizeof *thp);
+	if (dst.kva == NULL || thp == NULL
+			|| pml4e_walk_pde (thread_current ()->pml4, (uint64_t) base,
+				true) == NULL
+			|| !spt_for_each (spt, base, base + HPGSIZE, collapse_copy, &dst)) {
+		if (dst.kva != NULL)
+			palloc_free_multiple (dst.kva, HPGPAGES);
+		free (thp);
+		return false;
+	}
+
+	/* No unmapping batch is open on the fault path, so removing
+	 * the pages clears their mappings right away.  With nothing in
+	 * the stretch mapped and the page directory in place, the huge
+	 * page cannot fail to map. */
+	ASSERT (spt->tlb == NULL);
+	spt_remove_range (spt, base, base + HPGSIZE);
+	thp_map (vma, thp, base, dst.kva);
+	collapse_cnt++;
+	return true;
+}
+
+/* Collapses at most one stretch of the current process's memory
+ * into a huge page, unless the process last looked less than
+ * THP_SCAN_MSEC ago. */
+void
+thp_collapse (void) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+
+	if (!thp_enabled
+			|| timer_elapsed (spt->thp_scan_tick)
+			< THP_SCAN_MSEC * TIMER_FREQ / 1000)
+		return;
+	spt->thp_scan_tick = timer_ticks ();
+
+	for (vma = vma_next (spt, NULL); vma != NULL;
+			vma = vma_next (spt, vma->end)) {
+		void *base = hpg_round_down (vma->start + HPGSIZE - 1);
+
+		for (; base < vma->end; base += HPGSIZE)
+			if (thp_suitable (vma, base) && thp_find (vma, base) == NULL
+					&& collapse_stretch (vma, base))
+				return;
+	}
+}
+
+/* Returns the number of pages that huge pages back in SPT. */
+size_t
+thp_resident (struct supplemental_page_table *spt) {
+	struct vma *vma;
+	size_t cnt = 0;
+	void *p;
+
+	for (p = NULL; (vma = vma_next (spt, p)) != NULL; p = vma->end)
+		cnt += list_size (&vma->thps) * HPGPAGES;
+	return cnt;
+}
+
+/* Prints huge page statistics. */
+void
+thp_print_stats (void) {
+	if (!thp_enabled)
+		return;
+	printf ("THP: %"PRIu64" huge pages faulted in (%"PRIu64" fell back), "
+			"%"PRIu64" split, %"PRIu64" collapsed, %"PRIu64" copied\n",
+			fault_cnt, fallback_cnt, split_cnt, collapse_cnt, copy_cnt);
+	printf ("THP: %zu huge pages mapped\n", thp_cnt);
+}
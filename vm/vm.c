@@ -1,8 +1,106 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <inttypes.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+#include "vm/oom.h"
+#include "vm/pcache.h"
+#include "vm/shmem.h"
+#include "vm/thp.h"
+#include "vm/vma.h"
+
+/* Frame table: every user frame that currently holds a mapped
+ * page is on one of two LRU lists.  A frame starts out on the
+ * inactive list and is promoted to the active list when it is
+ * found referenced on two scans in a row; the active list is
+ * aged back onto the inactive list as eviction needs victims.
+ * Frames holding pages locked by mlock() or belonging to shared
+ * anonymous memory are kept on a third list instead, out of
+ * eviction's way. */
+static struct list active_list;
+static struct list inactive_list;
+static struct list unevictable_list;
+static struct lock frame_lock;          /* Protects the lists. */
+static struct condition evict_done;     /* Signaled after an eviction. */
+
+/* Every frame, whether or not it is on an LRU list, for ksmd to
+ * walk.  Also protected by frame_lock. */
+static struct list frame_list;
+static struct list_elem *ksm_cursor;    /* Next frame for ksmd. */
+
+/* Background reclaim. */
+static struct semaphore kswapd_sema;    /* Upped to wake kswapd. */
+static bool kswapd_awake;               /* kswapd is reclaiming. */
+static size_t low_wmark;                /* Free pages that wake kswapd. */
+static size_t high_wmark;               /* Free pages kswapd aims for. */
+
+/* Out of memory: how often and how long a thread that cannot get
+ * a frame waits for the OOM killer's victim to exit. */
+#define OOM_RETRIES 10
+#define OOM_WAIT_MSEC 10
+
+/* Background write-back of dirty file-backed pages. */
+#define WB_SCAN_MSEC 500                /* Delay between flusher scans. */
+#define WB_BATCH 32                     /* Most pages written per pass. */
+static struct condition writeback_done; /* Signaled after a write-back. */
+
+/* Working-set sampling. */
+#define WSS_SAMPLE_MSEC 1000            /* Length of a sample period. */
+static unsigned wss_gen;                /* Number of the last sample. */
+bool memstat_verbose;
+
+/* Eviction statistics. */
+static uint64_t evict_cnt;              /* Frames evicted. */
+static uint64_t evict_clean_cnt;        /* ...that needed no write-back. */
+static uint64_t direct_cnt;             /* ...by a faulting thread. */
+static uint64_t kswapd_cnt;             /* ...by kswapd. */
+static uint64_t scan_cnt;               /* Inactive frames scanned. */
+static uint64_t scan_max;               /* Longest scan for one victim. */
+static uint64_t activate_cnt;           /* Promotions to active. */
+static uint64_t deactivate_cnt;         /* Demotions to inactive. */
+
+/* Copy-on-write statistics. */
+static uint64_t share_cnt;              /* Frames shared by fork(). */
+static uint64_t cow_cnt;                /* Copies made on write. */
+static uint64_t zero_cnt;               /* Reads served by the zero page. */
+static uint64_t pcache_hit_cnt;         /* Frames found in the page cache. */
+static uint64_t ksm_merge_cnt;          /* Pages merged by ksmd. */
+
+/* Write-back statistics. */
+static uint64_t wb_page_cnt;            /* Pages written by the flusher. */
+static uint64_t wb_write_cnt;           /* ...in this many writes. */
+
+/* Memory locking. */
+size_t mlock_page_limit;
+static size_t mlock_cnt;                /* Pages locked now. */
+static size_t mlock_max;                /* ...at most. */
+
+/* Stack growth. */
+#define STACK_BURST_MSEC 100            /* Growth this close is a burst. */
+#define STACK_CHUNK_MAX 16              /* Most pages added at a time. */
+size_t stack_page_limit;
+static uint64_t stack_grow_cnt;         /* Times a stack grew. */
+static uint64_t stack_prefault_cnt;     /* Pages faulted in ahead. */
+
+/* Shared read-only frame of zeros, mapped by anonymous pages
+ * that have been read but never written. */
+static void *zero_kva;
+
+static void kswapd (void *aux);
+static void ksmd (void *aux);
+static void flusher (void *aux);
+static void wssd (void *aux);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +113,38 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&active_list);
+	list_init (&inactive_list);
+	list_init (&unevictable_list);
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+	cond_init (&writeback_done);
+	list_init (&frame_list);
+	pcache_init ();
+	shmem_init ();
+	ksm_init ();
+	oom_init ();
+
+	zero_kva = palloc_get_page (PAL_ZERO);
+	if (zero_kva == NULL)
+		PANIC ("vm_init: cannot allocate zero page");
+
+	sema_init (&kswapd_sema, 0);
+	low_wmark = palloc_page_cnt (PAL_USER) / 64 + 4;
+	high_wmark = 2 * low_wmark;
+	if (mlock_page_limit == 0)
+		mlock_page_limit = palloc_page_cnt (PAL_USER) / 4;
+	if (stack_page_limit == 0)
+		stack_page_limit = (1 << 20) / PGSIZE;
+	if (thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start kswapd");
+	if (thread_create ("flusher", PRI_DEFAULT, flusher, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start flusher");
+	if (thread_create ("wssd", PRI_MIN, wssd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start wssd");
+	if (ksm_enabled ()
+			&& thread_create ("ksmd", PRI_MIN, ksmd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start ksmd");
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +162,10 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct page *vm_lookup_page (void *va);
+static struct frame *vm_get_victim (const struct oom_scope *scope);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (const struct oom_scope *scope);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -47,97 +177,967 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *kva);
+	struct page *page;
+
+	upage = pg_round_down (upage);
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
-struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+/* Charges DELTA resident pages to the process owning SPT and to
+ * its tree.  Must be called with the frame table locked. */
+static void
+charge_rss (struct supplemental_page_table *spt, long delta) {
+	spt->rss_cnt += delta;
+	if (spt->tree != NULL)
+		spt->tree->rss += delta;
+}
 
-	return page;
+/* Makes PAGE one of the pages mapping FRAME. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->map_cnt++;
+	if (frame->page == NULL)
+		frame->page = page;
+	page->frame = frame;
+	charge_rss (&page->owner->spt, 1);
 }
 
-/* Insert PAGE into spt with validation. */
-bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+/* Undoes frame_link(). */
+static void
+frame_unlink (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == frame);
 
-	return succ;
+	list_remove (&page->frame_elem);
+	frame->map_cnt--;
+	page->frame = NULL;
+	page->young = false;
+	charge_rss (&page->owner->spt, -1);
+	frame->page = list_empty (&frame->pages) ? NULL
+		: list_entry (list_front (&frame->pages), struct page, frame_elem);
 }
 
-void
-spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+/* Returns true if FRAME may be evicted and, if so, stores
+ * through CLEAN whether that can be done without any I/O.
+ * Frames shared copy-on-write stay put until the sharing
+ * ends, and frames being written back until that is done. */
+static bool
+frame_evictable (struct frame *frame, bool *clean) {
+	struct page *page = frame->page;
+
+	if (frame->pinned || frame->map_cnt > 1 || frame->writeback)
+		return false;
+	*clean = page_get_type (page) == VM_FILE
+		&& !pml4_is_dirty (page->owner->pml4, page->va);
+	return true;
+}
+
+/* Tests and clears the accessed bit of FRAME's page, taking
+ * into account an access seen by the working-set sampler. */
+static bool
+frame_test_and_clear_accessed (struct frame *frame) {
+	struct page *page = frame->page;
+
+	if (!pml4_is_accessed (page->owner->pml4, page->va) && !page->young)
+		return false;
+	pml4_set_accessed (page->owner->pml4, page->va, false);
+	page->young = false;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if FRAME must not be evicted: it belongs to
+ * shared anonymous memory, which has nowhere to go, or one of
+ * its pages is locked by mlock(). */
+static bool
+frame_unevictable (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->shmem != NULL)
+		return true;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (list_entry (e, struct page, frame_elem)->locked)
+			return true;
+	return false;
+}
+
+/* Puts FRAME at the tail of the active list if ACTIVE is true,
+ * of the inactive list otherwise.  A frame that must not be
+ * evicted goes on the unevictable list whatever ACTIVE says. */
+static void
+frame_add (struct frame *frame, bool active) {
+	frame->unevictable = frame_unevictable (frame);
+	if (frame->unevictable) {
+		frame->active = false;
+		list_push_back (&unevictable_list, &frame->elem);
+		return;
+	}
+	frame->active = active;
+	frame->referenced = false;
+	list_push_back (active ? &active_list : &inactive_list, &frame->elem);
+	if (active)
+		activate_cnt++;
+}
+
+/* Moves FRAME, which is on one of the lists, to the one where
+ * it belongs now that one of its pages has been locked or
+ * unlocked. */
+static void
+frame_relist (struct frame *frame) {
+	if (frame->unevictable != frame_unevictable (frame)) {
+		list_remove (&frame->elem);
+		frame_add (frame, false);
+	}
+}
+
+/* Ages up to CNT frames from the head of the active list: those
+ * referenced since they were last looked at go round again, the
+ * others move to the inactive list. */
+static void
+shrink_active (size_t cnt) {
+	while (cnt-- > 0 && !list_empty (&active_list)) {
+		struct frame *frame = list_entry (list_pop_front (&active_list),
+				struct frame, elem);
+
+		if (frame->pinned || frame_test_and_clear_accessed (frame)) {
+			list_push_back (&active_list, &frame->elem);
+			continue;
+		}
+		frame_add (frame, false);
+		deactivate_cnt++;
+	}
+}
+
+/* Scans the inactive list for a frame to evict and takes it off
+ * the list.
+ *
+ * A frame referenced since it was last scanned is given another
+ * trip around the list, or promoted to the active list if this
+ * is its second reference in a row.  Among unreferenced frames,
+ * the first holding a clean file-backed page is taken, since
+ * dropping it costs no I/O; failing that, the first one seen.
+ * Only frames of processes in SCOPE are taken; SCOPE may be a
+ * null pointer for any process.  Returns a null pointer if the
+ * list has no candidate. */
 static struct frame *
-vm_get_victim (void) {
+scan_inactive (const struct oom_scope *scope) {
+	size_t frame_cnt = list_size (&inactive_list);
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t scanned;
+
+	for (scanned = 0; scanned < frame_cnt; ) {
+		struct frame *frame = list_entry (list_pop_front (&inactive_list),
+				struct frame, elem);
+		bool clean;
 
+		scanned++;
+		if (!frame_evictable (frame, &clean)
+				|| !oom_in_scope (scope, frame->page->owner)) {
+			list_push_back (&inactive_list, &frame->elem);
+			continue;
+		}
+		if (frame_test_and_clear_accessed (frame)) {
+			if (frame->referenced)
+				frame_add (frame, true);
+			else {
+				frame->referenced = true;
+				list_push_back (&inactive_list, &frame->elem);
+			}
+			continue;
+		}
+		if (clean) {
+			if (victim != NULL)
+				list_push_front (&inactive_list, &victim->elem);
+			victim = frame;
+			break;
+		}
+		if (victim == NULL)
+			victim = frame;
+		else
+			list_push_back (&inactive_list, &frame->elem);
+	}
+
+	scan_cnt += scanned;
+	if (scanned > scan_max)
+		scan_max = scanned;
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Get the struct frame, that will be evicted.
+ *
+ * Keeps the inactive list at least as long as the active one,
+ * so that pages touched only once, as by a large scan, age out
+ * through the inactive list without pushing the working set on
+ * the active list out of memory.  The victim, a frame of a
+ * process in SCOPE as for scan_inactive(), is taken off the
+ * frame table and marked as being evicted.  Returns a null
+ * pointer if no frame is evictable.
+ * Must be called with the frame table locked. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+vm_get_victim (const struct oom_scope *scope) {
+	struct frame *victim;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (list_size (&inactive_list) < list_size (&active_list))
+		shrink_active (list_size (&active_list) - list_size (&inactive_list));
+	victim = scan_inactive (scope);
+	if (victim == NULL) {
+		shrink_active (list_size (&active_list));
+		victim = scan_inactive (scope);
+	}
+	if (victim != NULL) {
+		victim->evicting = true;
+		pcache_remove (victim);
+		ksm_remove (victim);
+	}
+	return victim;
+}
 
+/* Evict one page, of a process in SCOPE as for scan_inactive(),
+ * and return the corresponding frame.
+ * Return NULL on error.
+ *
+ * The frame table lock is dropped while the page is written
+ * out; anyone who needs the page in the meantime waits on
+ * evict_done. */
+static struct frame *
+vm_evict_frame (const struct oom_scope *scope) {
+	size_t tries;
+
+	lock_acquire (&frame_lock);
+	tries = list_size (&active_list) + list_size (&inactive_list);
+	while (tries-- > 0) {
+		struct frame *victim = vm_get_victim (scope);
+		struct page *page;
+		bool clean, ok;
+
+		if (victim == NULL)
+			break;
+		page = victim->page;
+		frame_evictable (victim, &clean);
+
+		lock_release (&frame_lock);
+		ok = swap_out (page);
+		lock_acquire (&frame_lock);
+
+		victim->evicting = false;
+		cond_broadcast (&evict_done, &frame_lock);
+		if (!ok) {
+			/* It could not be written out; keep it away from
+			 * the inactive list for a while. */
+			frame_add (victim, true);
+			continue;
+		}
+		frame_unlink (victim, page);
+		lock_release (&frame_lock);
+
+		evict_cnt++;
+		if (clean)
+			evict_clean_cnt++;
+		return victim;
+	}
+	lock_release (&frame_lock);
 	return NULL;
 }
 
+/* Returns PAGE's frame, or a null pointer if it has none,
+ * first waiting for any eviction of PAGE in progress to finish.
+ * Must be called with the frame table locked. */
+static struct frame *
+page_frame (struct page *page) {
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+	return page->frame;
+}
+
+/* Background reclaimer.  Woken when the user pool drops below
+ * the low watermark, it evicts pages until the pool is back
+ * above the high watermark, so that faulting threads seldom
+ * have to evict pages themselves. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+		while (palloc_free_cnt (PAL_USER) < high_wmark) {
+			struct frame *frame = vm_evict_frame (NULL);
+			if (frame == NULL)
+				break;
+			vm_free_frame (frame);
+			kswapd_cnt++;
+		}
+		kswapd_awake = false;
+	}
+}
+
+/* Merges the page of FRAME into MATCH, which had the same
+ * checksum, if their contents are indeed the same.  Every page
+ * of both is write-protected first, so that neither can change
+ * while they are compared or afterward.  On success FRAME is
+ * left mapped by nothing and off the LRU lists, to be freed.
+ * Must be called with the frame table locked. */
+static bool
+ksm_merge (struct frame *frame, struct frame *match) {
+	struct page *page = frame->page;
+	struct list_elem *e;
+
+	if (match == frame || match->pinned || match->evicting)
+		return false;
+
+	pml4_set_writable (page->owner->pml4, page->va, false);
+	for (e = list_begin (&match->pages); e != list_end (&match->pages);
+			e = list_next (e)) {
+		struct page *p = list_entry (e, struct page, frame_elem);
+		pml4_set_writable (p->owner->pml4, p->va, false);
+	}
+	if (memcmp (frame->kva, match->kva, PGSIZE) != 0)
+		return false;
+
+	anon_discard_swap (page);
+	frame_unlink (frame, page);
+	frame_link (match, page);
+	pml4_set_page (page->owner->pml4, page->va, match->kva, false);
+	list_remove (&frame->elem);
+	ksm_remove (frame);
+	ksm_merge_cnt++;
+	return true;
+}
+
+/* Looks at FRAME for ksmd.  A resident anonymous page that is
+ * alone on its frame and whose contents have not changed since
+ * the last scan is merged with an identical frame seen before,
+ * if there is one, or else entered in the merging table itself.
+ * Returns true if FRAME was merged away and should be freed.
+ * Must be called with the frame table locked. */
+static bool
+ksm_scan_frame (struct frame *frame) {
+	struct page *page = frame->page;
+	struct frame *match;
+	uint32_t sum;
+
+	/* A frame not mapped at its page yet is still being filled. */
+	if (frame->map_cnt != 1 || frame->pinned || frame->evicting
+			|| frame->unevictable
+			|| frame->inode != NULL || page->operations->type != VM_ANON
+			|| page->owner->pml4 == NULL
+			|| pml4_get_page (page->owner->pml4, page->va) != frame->kva)
+		return false;
+
+	sum = ksm_checksum (frame->kva);
+	if (frame->ksm_listed) {
+		if (sum == frame->ksm_sum)
+			return false;
+		ksm_remove (frame);
+	}
+	if (!frame->ksm_seen || sum != frame->ksm_sum) {
+		/* Too soon to tell whether it is worth merging. */
+		frame->ksm_seen = true;
+		frame->ksm_sum = sum;
+		return false;
+	}
+
+	match = ksm_find (sum);
+	if (match == NULL) {
+		ksm_insert (frame, sum);
+		return false;
+	}
+	return ksm_merge (frame, match);
+}
+
+/* Samepage merging daemon.  Every KSM_SCAN_MSEC it scans the
+ * next ksm_pages_to_scan frames of the frame list, wrapping
+ * around at the end, and frees the frames whose pages it has
+ * merged into others. */
+static void
+ksmd (void *aux UNUSED) {
+	struct list merged;
+
+	list_init (&merged);
+	for (;;) {
+		timer_msleep (KSM_SCAN_MSEC);
+
+		lock_acquire (&frame_lock);
+		for (size_t i = 0; i < ksm_pages_to_scan && !list_empty (&frame_list);
+				i++) {
+			struct frame *frame;
+
+			if (ksm_cursor == NULL || ksm_cursor == list_end (&frame_list))
+				ksm_cursor = list_begin (&frame_list);
+			frame = list_entry (ksm_cursor, struct frame, all_elem);
+			ksm_cursor = list_next (ksm_cursor);
+			if (ksm_scan_frame (frame))
+				list_push_back (&merged, &frame->elem);
+		}
+		lock_release (&frame_lock);
+
+		while (!list_empty (&merged))
+			vm_free_frame (list_entry (list_pop_front (&merged),
+						struct frame, elem));
+	}
+}
+
+/* Takes up to WB_BATCH dirty file-backed pages from the frame
+ * list into PAGES and returns how many it took.  Each page's
+ * dirty bit is cleared as it is taken, so that a write made
+ * while it is being written back dirties it again, and its
+ * frame is marked as under write-back, which keeps it from
+ * being evicted or freed until flush_batch() is done. */
+static size_t
+flush_collect (struct wb_page pages[]) {
+	struct list_elem *e;
+	size_t cnt = 0;
+
+	lock_acquire (&frame_lock);
+	for (e = list_begin (&frame_list); e != list_end (&frame_list)
+			&& cnt < WB_BATCH; e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, all_elem);
+		struct page *page = frame->page;
+		enum intr_level old_level;
+		bool dirty;
+
+		if (page == NULL || frame->map_cnt != 1 || frame->evicting
+				|| frame->writeback || page->operations->type != VM_FILE
+				|| page->file.file == NULL || page->owner->pml4 == NULL)
+			continue;
+
+		old_level = intr_disable ();
+		dirty = pml4_is_dirty (page->owner->pml4, page->va);
+		if (dirty)
+			pml4_set_dirty (page->owner->pml4, page->va, false);
+		intr_set_level (old_level);
+
+		if (dirty) {
+			frame->writeback = true;
+			pages[cnt++] = (struct wb_page) { .page = page, .kva = frame->kva };
+		}
+	}
+	lock_release (&frame_lock);
+	return cnt;
+}
+
+/* Writes back the CNT pages in PAGES, taken by flush_collect().
+ * A page that could not be written is marked dirty again, to
+ * be written back later or when it is unmapped. */
+static void
+flush_batch (struct wb_page pages[], size_t cnt) {
+	size_t write_cnt = file_write_back (pages, cnt);
+
+	lock_acquire (&frame_lock);
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = pages[i].page;
+
+		if (pages[i].ok)
+			wb_page_cnt++;
+		else if (page->owner->pml4 != NULL)
+			pml4_set_dirty (page->owner->pml4, page->va, true);
+		page->frame->writeback = false;
+	}
+	wb_write_cnt += write_cnt;
+	cond_broadcast (&writeback_done, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Write-back daemon.  Every WB_SCAN_MSEC it writes the dirty
+ * file-backed pages of all processes back to their files, so
+ * that unmapping them or evicting them later seldom has to wait
+ * for a write. */
+static void
+flusher (void *aux UNUSED) {
+	struct wb_page pages[WB_BATCH];
+
+	for (;;) {
+		size_t cnt;
+
+		timer_msleep (WB_SCAN_MSEC);
+		do {
+			cnt = flush_collect (pages);
+			if (cnt > 0)
+				flush_batch (pages, cnt);
+		} while (cnt == WB_BATCH);
+	}
+}
+
+/* Takes a working-set sample: counts, for each process, the
+ * resident pages it has accessed since the last sample.  The
+ * accessed bits are cleared, so that the next sample sees only
+ * new accesses, and handed over to the pages' young flags, so
+ * that eviction still sees the pages as referenced. */
+static void
+wss_sample (void) {
+	struct list_elem *e, *pe;
+
+	lock_acquire (&frame_lock);
+	wss_gen++;
+	for (e = list_begin (&frame_list); e != list_end (&frame_list);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, all_elem);
+
+		for (pe = list_begin (&frame->pages); pe != list_end (&frame->pages);
+				pe = list_next (pe)) {
+			struct page *page = list_entry (pe, struct page, frame_elem);
+			struct supplemental_page_table *spt = &page->owner->spt;
+			uint64_t *pml4 = page->owner->pml4;
+
+			if (pml4 == NULL || !pml4_is_accessed (pml4, page->va))
+				continue;
+			pml4_set_accessed (pml4, page->va, false);
+			page->young = true;
+			if (spt->wss_gen != wss_gen) {
+				spt->wss_gen = wss_gen;
+				spt->wss_cnt = 0;
+			}
+			spt->wss_cnt++;
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Working-set sampler.  Takes a sample every WSS_SAMPLE_MSEC, so
+ * that a process's working set is estimated as the pages it
+ * used over the last such period. */
+static void
+wssd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (WSS_SAMPLE_MSEC);
+		wss_sample ();
+	}
+}
+
+/* Wakes kswapd if the user pool is running low. */
+static void
+kswapd_poke (void) {
+	if (!kswapd_awake && palloc_free_cnt (PAL_USER) < low_wmark) {
+		kswapd_awake = true;
+		sema_up (&kswapd_sema);
+	}
+}
+
+/* Initializes FRAME as a frame for the user page at KVA and puts
+ * it in the list of all frames, but on none of the LRU lists. */
+static void
+frame_init (struct frame *frame, void *kva) {
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->map_cnt = 0;
+	frame->inode = NULL;
+	frame->ksm_listed = false;
+	frame->pinned = false;
+	frame->evicting = false;
+	frame->writeback = false;
+	frame->ksm_seen = false;
+	frame->unevictable = false;
+	frame->shmem = NULL;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_list, &frame->all_elem);
+	lock_release (&frame_lock);
+}
+
+/* Returns a new frame for the user page at KVA, initialized by
+ * frame_init(), or a null pointer if kernel memory is short. */
+static struct frame *
+frame_create (void *kva) {
+	struct frame *frame = malloc (sizeof *frame);
+
+	if (frame != NULL)
+		frame_init (frame, kva);
+	return frame;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.
+ *
+ * A process at its resident page limit, or whose tree is at its
+ * limit, evicts a page of its own, or of its tree, instead.
+ * When nothing can be evicted, the OOM killer picks a process to
+ * kill and the allocation is retried once it has exited.
+ * Returns a null pointer if the current process is the one
+ * picked, or if no memory turns up; either way the current
+ * process is left marked to be killed. */
 static struct frame *
 vm_get_frame (void) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct oom_scope scope;
+	int tries;
+
+	for (tries = 0; ; tries++) {
+		bool limited = oom_rss_limited (1, &scope);
+		void *kva = limited ? NULL : palloc_get_page (PAL_USER);
+
+		kswapd_poke ();
+		if (kva != NULL) {
+			frame = frame_create (kva);
+			if (frame != NULL)
+				break;
+			/* Out of kernel memory: an evicted frame comes with
+			 * its struct frame. */
+			palloc_free_page (kva);
+		}
+		frame = vm_evict_frame (limited ? &scope : NULL);
+		if (frame != NULL) {
+			direct_cnt++;
+			break;
+		}
+		if (tries == OOM_RETRIES || !oom_kill (limited ? &scope : NULL)
+				|| spt->oom_killed) {
+			spt->oom_killed = true;
+			return NULL;
+		}
+		timer_msleep (OOM_WAIT_MSEC);
+	}
+	frame->pinned = false;
+	frame->evicting = false;
+	frame->ksm_seen = false;
+	frame->unevictable = false;
+	frame->shmem = NULL;
 
 	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	ASSERT (frame->page == NULL && frame->map_cnt == 0);
+	ASSERT (frame->inode == NULL && !frame->ksm_listed);
 	return frame;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr UNUSED) {
+/* Sets whether the frame of PAGE, if it has one, may be
+ * evicted.  Returns true if PAGE has a frame. */
+static bool
+vm_frame_pin (struct page *page, bool pinned) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	if (frame != NULL)
+		frame->pinned = pinned;
+	lock_release (&frame_lock);
+	return frame != NULL;
 }
 
-/* Handle the fault on write_protected page */
+/* spt_for_each() action for vm_memstat(): counts PAGE in the
+ * struct memstat AUX. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+memstat_page (struct page *page, void *st_) {
+	struct memstat *st = st_;
+	struct frame *frame = page->frame;
+
+	if (frame == NULL) {
+		if (page->operations->type == VM_ANON
+				&& (page->anon.slot != SWAP_SLOT_NONE
+					|| page->anon.zentry != NULL))
+			st->swap++;
+	} else if (frame->map_cnt > 1 || frame->shmem != NULL)
+		st->rss_shared++;
+	else if (page_get_type (page) == VM_FILE)
+		st->rss_file++;
+	else
+		st->rss_anon++;
+	return true;
+}
+
+/* Stores the current process's memory use in *ST.  Pages on
+ * frames that other pages map as well, whether copy-on-write,
+ * through the page cache or as shared anonymous memory, count
+ * as shared rather than as anonymous or file-backed. */
+void
+vm_memstat (struct memstat *st) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+
+	memset (st, 0, sizeof *st);
+	lock_acquire (&frame_lock);
+	spt_for_each (spt, NULL, (void *) KERN_BASE, memstat_page, st);
+	st->wss = spt->wss_gen == wss_gen ? spt->wss_cnt : 0;
+	lock_release (&frame_lock);
+	st->rss_anon += thp_resident (spt);
+	st->maj_flt = spt->maj_flt;
+	st->min_flt = spt->min_flt;
+}
+
+/* Prints the current process's memory use. */
+void
+vm_print_memstat (void) {
+	struct memstat st;
+
+	vm_memstat (&st);
+	printf ("%s: rss %zu anon, %zu file, %zu shared; %zu swapped; "
+			"wss %zu; %"PRIu64" major, %"PRIu64" minor faults\n",
+			thread_name (), st.rss_anon, st.rss_file, st.rss_shared, st.swap,
+			st.wss, st.maj_flt, st.min_flt);
+}
+
+/* Prints eviction statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %"PRIu64" evictions (%"PRIu64" clean, %"PRIu64" direct), "
+			"%"PRIu64" by kswapd\n",
+			evict_cnt, evict_clean_cnt, direct_cnt, kswapd_cnt);
+	printf ("VM: %"PRIu64" frames scanned, %"PRIu64" max per eviction, "
+			"%"PRIu64" activated, %"PRIu64" deactivated\n",
+			scan_cnt, scan_max, activate_cnt, deactivate_cnt);
+	printf ("VM: %"PRIu64" pages shared copy-on-write, %"PRIu64" copied, "
+			"%"PRIu64" mapped to the zero page\n",
+			share_cnt, cow_cnt, zero_cnt);
+	printf ("VM: %"PRIu64" page cache hits, %zu frames cached\n",
+			pcache_hit_cnt, pcache_size ());
+	printf ("VM: %zu pages locked (max %zu), %zu frames unevictable\n",
+			mlock_cnt, mlock_max, list_size (&unevictable_list));
+	printf ("VM: %"PRIu64" pages written back by the flusher "
+			"in %"PRIu64" writes\n", wb_page_cnt, wb_write_cnt);
+	printf ("VM: %"PRIu64" stack growths, %"PRIu64" pages pre-faulted\n",
+			stack_grow_cnt, stack_prefault_cnt);
+	if (ksm_enabled ()) {
+		printf ("KSM: %"PRIu64" pages merged\n", ksm_merge_cnt);
+		/* We may be powering off after a panic. */
+		if (lock_try_acquire (&frame_lock)) {
+			ksm_print_stats ();
+			lock_release (&frame_lock);
+		}
+	}
+	vma_print_stats ();
+	thp_print_stats ();
+	anon_print_stats ();
+	oom_print_stats ();
+}
+
+/* Growing the stack.
+ *
+ * ADDR, which no mapping covers, is taken to be an access to the
+ * stack if it lies at most 8 bytes below RSP (as a PUSH faults)
+ * and within stack_page_limit pages of USER_STACK.  The stack's
+ * VMA is then extended down over it, unless that would bring it
+ * within STACK_GUARD_PAGES of the mapping below.
+ *
+ * A program that grows its stack a page at a time takes a fault
+ * for each, so growth that follows closely on the last doubles
+ * the number of pages added, up to STACK_CHUNK_MAX; the pages
+ * below ADDR's are faulted in ahead while memory is plentiful.
+ * Returns true if ADDR is now part of the stack. */
+static bool
+vm_stack_growth (void *addr, void *rsp) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *limit = (void *) USER_STACK - stack_page_limit * PGSIZE;
+	struct vma *vma = vma_next (spt, addr);
+	size_t chunk;
+	void *start, *va;
+
+	if (vma == NULL || !(vma->type & VM_STACK) || addr < limit
+			|| (uintptr_t) addr + 8 < (uintptr_t) rsp)
+		return false;
+
+	if (spt->stack_chunk > 0
+			&& timer_elapsed (spt->stack_grow_tick)
+				< STACK_BURST_MSEC * TIMER_FREQ / 1000)
+		chunk = spt->stack_chunk * 2;
+	else
+		chunk = 1;
+	if (chunk > STACK_CHUNK_MAX)
+		chunk = STACK_CHUNK_MAX;
+
+	addr = pg_round_down (addr);
+	start = (size_t) (addr - limit) / PGSIZE >= chunk - 1
+		? addr - (chunk - 1) * PGSIZE : limit;
+	if (!vma_grow_down (spt, vma, start)) {
+		start = addr;
+		if (!vma_grow_down (spt, vma, start))
+			return false;
+	}
+	spt->stack_chunk = (addr - start) / PGSIZE + 1;
+	spt->stack_grow_tick = timer_ticks ();
+	stack_grow_cnt++;
+
+	/* The caller faults in ADDR's own page. */
+	for (va = addr - PGSIZE; va >= start; va -= PGSIZE) {
+		struct page *page = vm_lookup_page (va);
+		if (page == NULL || !vm_prefetch_page (page))
+			break;
+		stack_prefault_cnt++;
+	}
+	return true;
+}
+
+/* Maps PAGE, which vma_zero_page() says would be all zeros, to
+ * the zero page, read-only.  It gets a frame of its own on the
+ * first write. */
+static bool
+vm_map_zero_page (struct page *page) {
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_kva, false))
+		return false;
+	zero_cnt++;
+	return true;
+}
+
+/* Returns true if bringing PAGE into memory will have to read
+ * it from a file or from the swap disk. */
+static bool
+page_in_needs_io (struct page *page) {
+	struct inode *inode;
+	off_t offset;
+	size_t read_bytes;
+	bool cached;
+
+	if (page->frame != NULL)
+		return false;
+	switch (page->operations->type) {
+		case VM_ANON:
+			return page->anon.zentry == NULL
+				&& page->anon.slot != SWAP_SLOT_NONE;
+		case VM_FILE:
+			return page->file.read_bytes > 0;
+		default:
+			if (!vma_reads_file (page))
+				return false;
+			if (!vma_cache_key (page, &inode, &offset, &read_bytes))
+				return true;
+			lock_acquire (&frame_lock);
+			cached = pcache_find (inode, offset) != NULL;
+			lock_release (&frame_lock);
+			return !cached;
+	}
+}
+
+/* Handle the fault on write_protected page.
+ *
+ * PAGE is writable but mapped read-only, either to the zero page
+ * or because its frame is shared with another process, by
+ * fork() or through the page cache.
+ * In the first case it now gets a frame.  In the second, if PAGE
+ * is still not alone on the frame, it gets a copy of its own;
+ * otherwise the others have gone and it can simply take the
+ * frame over. */
+static bool
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *frame, *copy;
+	bool shared;
+
+	if (page->operations->type == VM_UNINIT)
+		return vm_do_claim_page (page);
+
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	shared = frame != NULL && frame->map_cnt > 1;
+	if (frame != NULL && !shared) {
+		pcache_remove (frame);
+		pml4_set_writable (pml4, page->va, true);
+	}
+	lock_release (&frame_lock);
+	if (!shared) {
+		/* If it was evicted, the retried access faults it in. */
+		return true;
+	}
+
+	/* Getting a frame may evict, so the frame table lock cannot
+	 * be held meanwhile; look again once it is back. */
+	copy = vm_get_frame ();
+	if (copy == NULL)
+		return false;
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	if (frame == NULL || frame->map_cnt == 1) {
+		if (frame != NULL) {
+			pcache_remove (frame);
+			pml4_set_writable (pml4, page->va, true);
+		}
+		lock_release (&frame_lock);
+		vm_free_frame (copy);
+		return true;
+	}
+	memcpy (copy->kva, frame->kva, PGSIZE);
+	frame_unlink (frame, page);
+	frame_relist (frame);
+	frame_link (copy, page);
+	pml4_set_page (pml4, page->va, copy->kva, true);
+	frame_add (copy, false);
+	lock_release (&frame_lock);
+	cow_cnt++;
+	return true;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	struct vma *vma;
+	bool first, major;
 
-	return vm_do_claim_page (page);
+	/* Validate the fault */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	if (not_present && (vma = vma_find (spt, addr)) != NULL
+			&& thp_fault (vma, addr)) {
+		spt->min_flt++;
+		return true;
+	}
+	page = vm_lookup_page (addr);
+	if (page == NULL && not_present
+			&& vm_stack_growth (addr, user ? (void *) f->rsp
+				: thread_current ()->user_rsp))
+		page = vm_lookup_page (addr);
+	if (page == NULL)
+		return false;
+	if (!not_present) {
+		if (!write || !page->writable || !vm_handle_wp (page))
+			return false;
+		spt->min_flt++;
+		return true;
+	}
+	if (write && !page->writable)
+		return false;
+	if (!write && !spt->mlock_future && vma_zero_page (page)) {
+		if (!vm_map_zero_page (page))
+			return false;
+		spt->min_flt++;
+		return true;
+	}
+
+	first = page->operations->type == VM_UNINIT;
+	major = page_in_needs_io (page);
+	if (!vm_do_claim_page (page))
+		return false;
+	if (major)
+		spt->maj_flt++;
+	else
+		spt->min_flt++;
+	if (spt->mlock_future && spt->locked_cnt < mlock_page_limit)
+		vm_mlock_page (page);
+	if (first && (vma = vma_find (spt, page->va)) != NULL)
+		vma_readahead (vma, page->va);
+	else if (page_get_type (page) == VM_ANON)
+		anon_swap_readahead (page);
+	thp_collapse ();
+	return true;
 }
 
 /* Free the page.
@@ -148,43 +1148,538 @@ vm_dealloc_page (struct page *page) {
 	free (page);
 }
 
+/* Removes PAGE's mapping from its owner's page table and
+ * returns whether the process had written to the page.  Between
+ * vm_unmap_begin() and vm_unmap_end(), the TLB invalidation of a
+ * page of the current process is left to the batch. */
+bool
+vm_unmap_page (struct page *page) {
+	struct thread *owner = page->owner;
+	uint64_t *pml4 = owner->pml4;
+	struct mmu_gather *tlb = owner == thread_current () ? owner->spt.tlb : NULL;
+	enum intr_level old_level;
+	bool dirty;
+
+	if (pml4 == NULL)
+		return false;
+
+	/* Keep the owner from dirtying the page between the two. */
+	old_level = intr_disable ();
+	dirty = pml4_is_dirty (pml4, page->va);
+	if (tlb != NULL)
+		mmu_gather_clear_page (tlb, page->va);
+	else
+		pml4_clear_page (pml4, page->va);
+	intr_set_level (old_level);
+	return dirty;
+}
+
+/* Starts batching the unmapping of the current process's pages
+ * in TLB.  Until vm_unmap_end(), the pages destroyed have their
+ * mappings removed without a TLB invalidation each, and the
+ * frames freed are held back until one invalidation covers them
+ * all. */
+void
+vm_unmap_begin (struct mmu_gather *tlb) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->spt.tlb == NULL);
+	mmu_gather_init (tlb, t->pml4);
+	t->spt.tlb = tlb;
+}
+
+/* Ends the batch started by vm_unmap_begin().  Whatever is still
+ * mapped in [START, END) is removed along the way, and page
+ * tables left empty are freed; pass an empty range if the page
+ * table is about to be destroyed anyway. */
+void
+vm_unmap_end (struct mmu_gather *tlb, void *start, void *end) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->spt.tlb == tlb);
+	if (tlb->pml4 != NULL && start < end)
+		pml4_clear_range (tlb, start, end);
+	t->spt.tlb = NULL;
+	mmu_gather_finish (tlb);
+}
+
+/* Takes PAGE's frame out of the frame table, so that it can no
+ * longer be evicted, and unlinks it from PAGE.  Returns the
+ * frame, or a null pointer if PAGE has none.  If other pages
+ * still share the frame, or shared anonymous memory owns it,
+ * PAGE is only unmapped from it and a null pointer is returned
+ * as well.  Waits for the flusher if it is writing PAGE back. */
+struct frame *
+vm_detach_frame (struct page *page) {
+	struct frame *frame;
+	bool shared = false;
+
+	lock_acquire (&frame_lock);
+	while ((frame = page_frame (page)) != NULL && frame->writeback)
+		cond_wait (&writeback_done, &frame_lock);
+	if (frame != NULL) {
+		if (page->locked) {
+			page->locked = false;
+			page->owner->spt.locked_cnt--;
+			mlock_cnt--;
+		}
+		shared = frame->map_cnt > 1 || frame->shmem != NULL;
+		if (!shared) {
+			list_remove (&frame->elem);
+			pcache_remove (frame);
+			ksm_remove (frame);
+		}
+		frame_unlink (frame, page);
+		if (shared)
+			frame_relist (frame);
+	}
+	lock_release (&frame_lock);
+
+	if (shared) {
+		vm_unmap_page (page);
+		return NULL;
+	}
+	return frame;
+}
+
+/* Gives FRAME, detached by vm_detach_frame(), back to the page
+ * allocator, after the TLB invalidation if the current process
+ * is batching its unmapping.  FRAME may be a null pointer. */
+void
+vm_free_frame (struct frame *frame) {
+	struct mmu_gather *tlb = thread_current ()->spt.tlb;
+
+	if (frame != NULL) {
+		lock_acquire (&frame_lock);
+		if (ksm_cursor == &frame->all_elem)
+			ksm_cursor = list_next (ksm_cursor);
+		list_remove (&frame->all_elem);
+		lock_release (&frame_lock);
+
+		if (tlb != NULL)
+			mmu_gather_free_page (tlb, frame->kva);
+		else
+			palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Charges DELTA resident pages that are not in the frame table,
+ * such as those of huge pages, to the current process. */
+void
+vm_charge_rss (long delta) {
+	lock_acquire (&frame_lock);
+	charge_rss (&thread_current ()->spt, delta);
+	lock_release (&frame_lock);
+}
+
+/* Gives PAGE, a new anonymous page of the current process, the
+ * user page at KVA as its frame, using FRAME, which the caller
+ * obtained from malloc(), to track it.  KVA already holds PAGE's
+ * contents and is mapped at PAGE's address; this is how a huge
+ * page that is split hands its frames out. */
+void
+vm_adopt_frame (struct page *page, struct frame *frame, void *kva) {
+	frame_init (frame, kva);
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	frame_add (frame, false);
+	lock_release (&frame_lock);
+}
+
+/* Copies the contents of PAGE to DST, provided that PAGE is
+ * resident, on a frame no other page maps, and could be evicted.
+ * Returns true if it did. */
+bool
+vm_copy_private_frame (struct page *page, void *dst) {
+	struct frame *frame;
+	bool ok;
+
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	ok = frame != NULL && frame->map_cnt == 1 && !frame->unevictable
+		&& !frame->pinned;
+	if (ok)
+		memcpy (dst, frame->kva, PGSIZE);
+	lock_release (&frame_lock);
+	return ok;
+}
+
+/* Frees FRAME, which belongs to shared anonymous memory that is
+ * going away.  No page may map it any more. */
+void
+vm_free_shmem_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->map_cnt == 0);
+	list_remove (&frame->elem);
+	frame->shmem = NULL;
+	lock_release (&frame_lock);
+	vm_free_frame (frame);
+}
+
+/* Unmaps PAGE from its owner's page table, discarding its
+ * contents, and frees its frame, if any. */
+void
+vm_release_frame (struct page *page) {
+	struct frame *frame = vm_detach_frame (page);
+
+	if (frame != NULL) {
+		vm_unmap_page (page);
+		vm_free_frame (frame);
+	}
+}
+
+/* Returns the current process's page at VA, creating it from
+ * the VMA that covers VA if it has not been touched yet.
+ * Returns a null pointer if VA is not mapped. */
+static struct page *
+vm_lookup_page (void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+	struct vma *vma;
+
+	va = pg_round_down (va);
+	page = spt_find_page (spt, va);
+	if (page == NULL && (vma = vma_find (spt, va)) != NULL)
+		page = vma_new_page (vma, va);
+	return page;
+}
+
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = vm_lookup_page (va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Brings the SIZE bytes at UADDR, in the current process, into
+ * memory for the kernel to access, writable if WRITE is true.
+ * Each page not already mapped as needed is faulted in just as a
+ * user access would fault it, so lazy pages are created and the
+ * stack grows.  A page evicted again before the kernel gets to
+ * it is simply faulted back in.  Returns false if part of the
+ * range is not valid for such an access. */
+bool
+vm_fault_in (const void *uaddr, size_t size, bool write) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	void *va;
+
+	if (size == 0)
+		return true;
+	if ((uintptr_t) uaddr + size < (uintptr_t) uaddr
+			|| !is_user_vaddr ((const char *) uaddr + size - 1))
+		return false;
+	for (va = pg_round_down (uaddr); va < uaddr + size; va += PGSIZE) {
+		uint64_t *pte = pml4e_walk (pml4, (uint64_t) va, false);
+		bool present = pte != NULL && (*pte & PTE_P);
+
+		if (present && (!write || is_writable (pte)))
+			continue;
+		if (!vm_try_handle_fault (NULL, va, false, write, !present))
+			return false;
+	}
+	return true;
+}
+
+/* Brings PAGE, a page of the current process, into memory
+ * ahead of use.  It joins the inactive list unreferenced, so it
+ * is among the first to go again if it is not used.  Only free
+ * frames are used: nothing is evicted to make room, and false
+ * is returned if memory is short or the process is at its
+ * limit. */
+bool
+vm_prefetch_page (struct page *page) {
+	if (palloc_free_cnt (PAL_USER) < low_wmark || oom_rss_limited (1, NULL))
+		return false;
+	return vm_do_claim_page (page);
+}
+
+/* Maps PAGE to FRAME, which already holds its contents, found
+ * in the page cache or in shared anonymous memory; the mapping
+ * is writable only if WRITABLE is true.
+ * Must be called with the frame table locked. */
+static bool
+vm_map_shared_frame (struct page *page, struct frame *frame, bool writable) {
+	frame_link (frame, page);
+	if (vma_init_cached_page (page, frame->kva)
+			&& pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				writable))
+		return true;
+	frame_unlink (frame, page);
+	return false;
+}
+
+/* Claim the PAGE and set up the mmu.
+ *
+ * A page whose contents the page cache may hold is given the
+ * cached frame if there is one.  Otherwise it is read in as
+ * usual and its frame is entered in the cache; it is mapped
+ * read-only either way, so that a private mapping takes a
+ * write-protect fault before it writes to the shared frame.
+ *
+ * A page of shared anonymous memory likewise maps the frame the
+ * memory holds for it, or gives it a new zeroed one. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+	struct shmem *shmem;
+	struct inode *inode;
+	off_t offset;
+	size_t read_bytes, idx;
+	bool cacheable;
+
+	/* Wait out any eviction of PAGE in progress, so that we do
+	 * not read its contents back before they are written out. */
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	if (frame != NULL) {
+		lock_release (&frame_lock);
+		return true;
+	}
+	shmem = vma_shmem (page, &idx);
+	if (shmem != NULL && shmem->frames[idx] != NULL) {
+		bool ok = vm_map_shared_frame (page, shmem->frames[idx],
+				page->writable);
+		lock_release (&frame_lock);
+		return ok;
+	}
+	cacheable = vma_cache_key (page, &inode, &offset, &read_bytes);
+	if (cacheable && (frame = pcache_find (inode, offset)) != NULL
+			&& frame->read_bytes == read_bytes) {
+		bool ok = vm_map_shared_frame (page, frame, false);
+		if (ok)
+			pcache_hit_cnt++;
+		lock_release (&frame_lock);
+		return ok;
+	}
+	lock_release (&frame_lock);
+
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
+
+	/* Insert page table entry to map page's VA to frame's PA. */
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable && !cacheable)) {
+		lock_acquire (&frame_lock);
+		frame_unlink (frame, page);
+		lock_release (&frame_lock);
+		vm_free_frame (frame);
+		return false;
+	}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	lock_acquire (&frame_lock);
+	if (shmem != NULL && shmem->frames[idx] != NULL) {
+		/* Another process got there first; use its frame. */
+		struct frame *winner = shmem->frames[idx];
 
-	return swap_in (page, frame->kva);
+		frame_unlink (frame, page);
+		frame_link (winner, page);
+		pml4_set_page (page->owner->pml4, page->va, winner->kva,
+				page->writable);
+		lock_release (&frame_lock);
+		vm_free_frame (frame);
+		return true;
+	}
+	if (shmem != NULL) {
+		frame->shmem = shmem;
+		shmem->frames[idx] = frame;
+	}
+	if (cacheable)
+		pcache_insert (frame, inode, offset, read_bytes);
+	frame_add (frame, false);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Shares the frame of SRC, an anonymous page of the parent,
+ * with a new page at the same address in the current process.
+ * Both mappings are made read-only, so that the first write
+ * through either one gives the writer a copy of its own. */
+static bool
+share_page (struct page *src) {
+	struct page *dst;
+	struct frame *frame;
+
+	if (!vm_alloc_page (VM_ANON, src->va, src->writable))
+		return false;
+	dst = spt_find_page (&thread_current ()->spt, src->va);
+	anon_initializer (dst, VM_ANON, NULL);
+
+	lock_acquire (&frame_lock);
+	frame = page_frame (src);
+	frame_link (frame, dst);
+	lock_release (&frame_lock);
+
+	if (!pml4_set_page (dst->owner->pml4, dst->va, frame->kva, false)) {
+		lock_acquire (&frame_lock);
+		frame_unlink (frame, dst);
+		lock_release (&frame_lock);
+		return false;
+	}
+	pml4_set_writable (src->owner->pml4, src->va, false);
+	share_cnt++;
+	return true;
+}
+
+/* Copies the page SRC of the parent into the current process's
+ * supplemental page table DST.  Pages the parent never touched
+ * stay lazy: those inside a VMA are simply left to be created
+ * from the child's copy of it, the others share their
+ * initializer's AUX.  Pages of shared anonymous memory are left
+ * to be mapped from it in the same way.  Resident anonymous
+ * pages are shared copy-on-write.  The rest are claimed right away and get a
+ * copy of the parent's contents; pages that have been evicted
+ * are brought back in first. */
+static bool
+copy_page (struct page *src, void *dst_spt) {
+	enum vm_type type = page_get_type (src);
+	struct vma *vma = vma_find (dst_spt, src->va);
+	struct page *dst;
+	bool ok;
+
+	if (vma != NULL && vma->shmem != NULL)
+		return true;
+	if (src->operations->type == VM_UNINIT)
+		return vma != NULL
+			|| vm_alloc_page_with_initializer (type, src->va, src->writable,
+					src->uninit.init, src->uninit.aux);
+
+	/* Keep SRC resident while claiming DST may evict frames. */
+	while (!vm_frame_pin (src, true))
+		if (!vm_do_claim_page (src))
+			return false;
+
+	if (type == VM_ANON) {
+		ok = share_page (src);
+		vm_frame_pin (src, false);
+		return ok;
+	}
+
+	ok = vm_alloc_page (type, src->va, src->writable)
+		&& vm_claim_page (src->va);
+	if (ok) {
+		dst = spt_find_page (dst_spt, src->va);
+		if (type == VM_FILE && vma != NULL) {
+			dst->file = src->file;
+			dst->file.file = vma->file;
+		}
+		memcpy (dst->frame->kva, src->frame->kva, PGSIZE);
+		if (pml4_is_dirty (src->owner->pml4, src->va))
+			pml4_set_dirty (dst->owner->pml4, dst->va, true);
+	}
+	vm_frame_pin (src, false);
+	return ok;
 }
 
-/* Initialize new supplemental page table */
+/* Called before the SIZE bytes at OFFSET in INODE are written
+ * over: any cached copies of them must not be handed out any
+ * more. */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+vm_invalidate_file (struct inode *inode, off_t offset, off_t size) {
+	lock_acquire (&frame_lock);
+	pcache_invalidate (inode, offset, size);
+	lock_release (&frame_lock);
+}
+
+/* Lets PAGE, if it is a resident anonymous page, be dropped
+ * rather than swapped out, as long as it is not written in the
+ * meantime; any copy in swap is freed, so that if PAGE is not
+ * resident it comes back zeroed.  Pages on shared frames are
+ * left alone.  For madvise(MADV_FREE); always returns true. */
+bool
+vm_lazyfree_page (struct page *page, void *aux UNUSED) {
+	struct frame *frame;
+
+	if (page->operations->type != VM_ANON)
+		return true;
+
+	lock_acquire (&frame_lock);
+	frame = page_frame (page);
+	if (frame == NULL)
+		anon_discard_swap (page);
+	else if (frame->map_cnt == 1) {
+		anon_discard_swap (page);
+		page->anon.lazyfree = true;
+		pml4_set_dirty (page->owner->pml4, page->va, false);
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Locks PAGE, a page of the current process, in memory, first
+ * bringing it in if need be.  Its frame is moved out of reach
+ * of eviction.  Returns false if PAGE cannot be brought in. */
+bool
+vm_mlock_page (struct page *page) {
+	struct frame *frame;
+
+	for (;;) {
+		lock_acquire (&frame_lock);
+		frame = page_frame (page);
+		if (frame != NULL)
+			break;
+		lock_release (&frame_lock);
+		if (!vm_do_claim_page (page))
+			return false;
+	}
+	if (!page->locked) {
+		page->locked = true;
+		page->owner->spt.locked_cnt++;
+		if (++mlock_cnt > mlock_max)
+			mlock_max = mlock_cnt;
+		frame_relist (frame);
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Undoes vm_mlock_page(). */
+void
+vm_munlock_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	if (page->locked) {
+		page->locked = false;
+		page->owner->spt.locked_cnt--;
+		mlock_cnt--;
+		frame_relist (page_frame (page));
+	}
+	lock_release (&frame_lock);
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	ASSERT (dst == &thread_current ()->spt);
+	dst->tree = mem_tree_get (src->tree);
+	dst->oom_score_adj = src->oom_score_adj;
+	return vma_copy (dst, src)
+		&& spt_for_each (src, NULL, (void *) KERN_BASE, copy_page, dst);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Destroy all the supplemental_page_table hold by thread and
+	 * writeback all the modified contents to the storage.  The
+	 * pages go first, since file-backed ones write back through
+	 * their VMA's file.  The page table is destroyed next, so the
+	 * batch need not clear it. */
+	struct mmu_gather tlb;
+
+	vm_unmap_begin (&tlb);
+	spt_remove_range (spt, NULL, (void *) KERN_BASE);
+	ASSERT (spt->root == NULL);
+	vma_kill (spt);
+	vm_unmap_end (&tlb, NULL, NULL);
 }
@@ -0,0 +1,719 @@
+/* vma.c: Virtual memory areas.
+ *
+ * Every mapping a process makes -- a segment of its executable,
+ * its stack, an mmap() of a file -- is recorded as one struct
+ * vma, whatever its size.  Nothing else is allocated until the
+ * process touches a page: the fault handler finds the covering
+ * VMA and only then creates the struct page, so setting up a
+ * mapping costs the same for one page as for a gigabyte.
+ *
+ * A process's VMAs never overlap, so ordering them by start
+ * address also orders them by end address.  They are kept in an
+ * AVL tree hanging off the supplemental page table, which bounds
+ * the fault-time lookup by the log of the number of mappings.
+ *
+ * Each VMA backed by a file also tracks how its pages are being
+ * faulted in.  A fault just past the pages last read extends a
+ * sequential run and doubles the readahead window; any other
+ * fault halves it.  The window's worth of pages following the
+ * fault is read in with it, so a sequential scan takes one fault
+ * per window instead of one per page.  madvise() can turn this
+ * off for a VMA or fix the window at its largest.
+ *
+ * An anonymous VMA mapped with MAP_SHARED takes its frames from
+ * a struct shmem (see vm/shmem.c) that the copies fork() makes
+ * of it refer to as well. */
+
+#include "vm/vma.h"
+#include <bitmap.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/shmem.h"
+#include "vm/thp.h"
+
+#define RA_INIT_PAGES 4                 /* Window at the start of a run. */
+#define RA_MAX_PAGES 32                 /* Largest window. */
+
+static uint64_t readahead_cnt;          /* Pages read ahead. */
+
+static bool vma_load_page (struct page *page, void *aux);
+
+static inline int
+vma_height (const struct vma *vma) {
+	return vma != NULL ? vma->height : 0;
+}
+
+/* Recomputes the height of VMA from its children. */
+static struct vma *
+vma_fix (struct vma *vma) {
+	int l = vma_height (vma->left), r = vma_height (vma->right);
+	vma->height = (l > r ? l : r) + 1;
+	return vma;
+}
+
+static struct vma *
+rotate_right (struct vma *vma) {
+	struct vma *left = vma->left;
+	vma->left = left->right;
+	left->right = vma_fix (vma);
+	return vma_fix (left);
+}
+
+static struct vma *
+rotate_left (struct vma *vma) {
+	struct vma *right = vma->right;
+	vma->right = right->left;
+	right->left = vma_fix (vma);
+	return vma_fix (right);
+}
+
+/* Restores the AVL invariant at VMA, whose subtrees differ in
+ * height by at most two, and returns the new subtree root. */
+static struct vma *
+vma_balance (struct vma *vma) {
+	int balance = vma_height (vma->left) - vma_height (vma->right);
+
+	if (balance > 1) {
+		if (vma_height (vma->left->left) < vma_height (vma->left->right))
+			vma->left = rotate_left (vma->left);
+		return rotate_right (vma);
+	}
+	if (balance < -1) {
+		if (vma_height (vma->right->right) < vma_height (vma->right->left))
+			vma->right = rotate_right (vma->right);
+		return rotate_left (vma);
+	}
+	return vma_fix (vma);
+}
+
+static struct vma *
+tree_insert (struct vma *root, struct vma *vma) {
+	if (root == NULL) {
+		vma->left = vma->right = NULL;
+		return vma_fix (vma);
+	}
+	if (vma->start < root->start)
+		root->left = tree_insert (root->left, vma);
+	else
+		root->right = tree_insert (root->right, vma);
+	return vma_balance (root);
+}
+
+/* Unlinks the leftmost node of ROOT into *MIN. */
+static struct vma *
+tree_remove_min (struct vma *root, struct vma **min) {
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+	root->left = tree_remove_min (root->left, min);
+	return vma_balance (root);
+}
+
+static struct vma *
+tree_remove (struct vma *root, struct vma *vma) {
+	ASSERT (root != NULL);
+
+	if (vma->start < root->start)
+		root->left = tree_remove (root->left, vma);
+	else if (vma->start > root->start)
+		root->right = tree_remove (root->right, vma);
+	else {
+		struct vma *min;
+
+		ASSERT (root == vma);
+		if (vma->right == NULL)
+			return vma->left;
+		root = tree_remove_min (vma->right, &min);
+		min->left = vma->left;
+		min->right = root;
+		root = min;
+	}
+	return vma_balance (root);
+}
+
+/* Returns the VMA in SPT with the lowest address that ends
+ * after VA, or a null pointer if there is none. */
+struct vma *
+vma_next (struct supplemental_page_table *spt, const void *va) {
+	struct vma *next = NULL;
+
+	for (struct vma *vma = spt->vma_root; vma != NULL; )
+		if ((const void *) vma->end > va) {
+			next = vma;
+			vma = vma->left;
+		} else
+			vma = vma->right;
+	return next;
+}
+
+/* Returns the VMA in SPT that contains VA, or a null pointer if
+ * VA is not mapped. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *va) {
+	struct vma *vma = vma_next (spt, va);
+	return vma != NULL && (const void *) vma->start <= va ? vma : NULL;
+}
+
+/* Maps [START, END) in SPT as pages of TYPE, the first
+ * READ_BYTES bytes of which are read from FILE starting at
+ * OFFSET.  FILE may be null if READ_BYTES is 0; otherwise the
+ * VMA holds its own reference to FILE, so the caller may close
+ * it.  Returns the new VMA, or a null pointer if the range is
+ * invalid, overlaps an existing mapping or memory is short. */
+struct vma *
+vma_create (struct supplemental_page_table *spt, void *start, void *end,
+		enum vm_type type, bool writable, struct file *file, off_t offset,
+		size_t read_bytes) {
+	struct vma *vma, *next;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (read_bytes <= (size_t) (end - start));
+	ASSERT (file != NULL || read_bytes == 0);
+
+	if (start >= end || start == NULL || !is_user_vaddr (end - 1))
+		return NULL;
+	next = vma_next (spt, start);
+	if (next != NULL && next->start < end)
+		return NULL;
+	if (next != NULL && (next->type & VM_STACK)
+			&& (size_t) (next->start - end) < STACK_GUARD_PAGES * PGSIZE)
+		return NULL;
+
+	vma = malloc (sizeof *vma);
+	if (vma == NULL)
+		return NULL;
+	*vma = (struct vma) {
+		.start = start,
+		.end = end,
+		.type = type,
+		.writable = writable,
+		.offset = offset,
+		.read_bytes = read_bytes,
+	};
+	list_init (&vma->thps);
+	if (file != NULL && (vma->file = file_reopen (file)) == NULL) {
+		free (vma);
+		return NULL;
+	}
+	spt->vma_root = tree_insert (spt->vma_root, vma);
+	return vma;
+}
+
+/* Extends VMA, a stack, down to START, which is page-aligned
+ * and below VMA's start.  Fails, returning false, if that would
+ * leave less than STACK_GUARD_PAGES pages between VMA and the
+ * mapping below it. */
+bool
+vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start) {
+	const size_t gap = STACK_GUARD_PAGES * PGSIZE;
+
+	ASSERT (vma->type & VM_STACK);
+	ASSERT (pg_ofs (start) == 0 && start < vma->start);
+
+	/* Nothing may end in [START - GAP, VMA->START), so the tree
+	 * stays ordered with VMA's key lowered in place. */
+	if (start == NULL || (uintptr_t) start < gap
+			|| vma_next (spt, start - gap) != vma)
+		return false;
+	vma->start = start;
+	return true;
+}
+
+/* Unmaps VMA from SPT, destroying the pages it has instantiated
+ * (which writes back any dirty file-backed ones), and frees it. */
+void
+vma_destroy (struct supplemental_page_table *spt, struct vma *vma) {
+	struct mmu_gather tlb;
+	bool batch = spt->tlb == NULL && spt == &thread_current ()->spt;
+
+	if (batch)
+		vm_unmap_begin (&tlb);
+	spt_remove_range (spt, vma->start, vma->end);
+	thp_release (vma);
+	spt->vma_root = tree_remove (spt->vma_root, vma);
+	shmem_put (vma->shmem);
+	if (batch)
+		vm_unmap_end (&tlb, vma->start, vma->end);
+	file_close (vma->file);
+	free (vma);
+}
+
+/* Creates the struct page for VA, which lies within VMA, in the
+ * current process's supplemental page table.  The page is left
+ * uninitialized; its contents are filled in from VMA when it is
+ * claimed.  If VA is in a huge page, that is split instead, and
+ * VA's page comes out of it resident.  Returns the page, or a
+ * null pointer on failure. */
+struct page *
+vma_new_page (struct vma *vma, void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	ASSERT (vma->start <= va && va < vma->end);
+
+	va = pg_round_down (va);
+	if (!thp_split (vma, va))
+		return NULL;
+	page = spt_find_page (spt, va);
+	if (page == NULL && vm_alloc_page_with_initializer (vma->type, va,
+				vma->writable, vma_load_page, vma))
+		page = spt_find_page (spt, va);
+	return page;
+}
+
+/* Records in PAGE, which is at offset OFS in VMA and has
+ * READ_BYTES bytes of file contents, where those come from. */
+static void
+vma_set_file (struct page *page, struct vma *vma, size_t ofs,
+		size_t read_bytes) {
+	if (VM_TYPE (vma->type) == VM_FILE)
+		page->file = (struct file_page) {
+			.file = vma->file,
+			.offset = vma->offset + ofs,
+			.read_bytes = read_bytes,
+		};
+}
+
+/* Initializer for pages created by vma_new_page(): fills the
+ * page's frame from the file part of VMA and zeroes the rest. */
+static bool
+vma_load_page (struct page *page, void *vma_) {
+	struct vma *vma = vma_;
+	size_t ofs = page->va - vma->start;
+	size_t read_bytes = ofs < vma->read_bytes ? vma->read_bytes - ofs : 0;
+	void *kva = page->frame->kva;
+
+	if (read_bytes > PGSIZE)
+		read_bytes = PGSIZE;
+	vma_set_file (page, vma, ofs, read_bytes);
+
+	if (read_bytes > 0
+			&& file_read_at (vma->file, kva, read_bytes, vma->offset + ofs)
+			!= (off_t) read_bytes)
+		return false;
+	memset (kva + read_bytes, 0, PGSIZE - read_bytes);
+	return true;
+}
+
+/* Returns true if PAGE is an anonymous page created by
+ * vma_new_page() that has not been claimed yet and has no file
+ * contents, so that it would be filled with zeros. */
+bool
+vma_zero_page (struct page *page) {
+	struct vma *vma = page->uninit.aux;
+
+	if (page->operations->type != VM_UNINIT
+			|| page->uninit.init != vma_load_page)
+		return false;
+	return VM_TYPE (vma->type) == VM_ANON && vma->shmem == NULL
+		&& (size_t) (page->va - vma->start) >= vma->read_bytes;
+}
+
+/* Brings into memory the pages of VMA in [START, END) that are
+ * not there, leaving out those that would be all zeros.  Stops
+ * early if memory runs short.  Returns the address it got to. */
+static void *
+vma_prefetch (struct vma *vma, void *start, void *end) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *p;
+
+	for (p = start; p < end; p += PGSIZE) {
+		struct page *page = spt_find_page (spt, p);
+
+		if (page == NULL) {
+			if ((size_t) (p - vma->start) >= vma->read_bytes)
+				continue;
+			page = vma_new_page (vma, p);
+		} else if (page->frame != NULL || vma_zero_page (page))
+			continue;
+		if (page == NULL || !vm_prefetch_page (page))
+			break;
+		readahead_cnt++;
+	}
+	return p;
+}
+
+/* Called after the process faulted in its page at VA, which lies
+ * within VMA, for the first time.  Adapts VMA's readahead window
+ * and reads in that many of the following pages with file
+ * contents that are not in memory yet. */
+void
+vma_readahead (struct vma *vma, void *va) {
+	void *end;
+
+	if (vma->file == NULL || vma->advice == MADV_RANDOM)
+		return;
+
+	va = pg_round_down (va);
+	if (vma->advice == MADV_SEQUENTIAL)
+		vma->ra_pages = RA_MAX_PAGES;
+	else if (vma->ra_next == NULL || va == vma->ra_next) {
+		vma->ra_pages *= 2;
+		if (vma->ra_pages < RA_INIT_PAGES)
+			vma->ra_pages = RA_INIT_PAGES;
+		else if (vma->ra_pages > RA_MAX_PAGES)
+			vma->ra_pages = RA_MAX_PAGES;
+	} else
+		vma->ra_pages /= 2;
+
+	end = va + (vma->ra_pages + 1) * PGSIZE;
+	if (end > vma->start + ROUND_UP (vma->read_bytes, PGSIZE))
+		end = vma->start + ROUND_UP (vma->read_bytes, PGSIZE);
+	if (end < va + PGSIZE)
+		end = va + PGSIZE;
+	vma->ra_next = vma_prefetch (vma, va + PGSIZE, end);
+}
+
+/* Returns true if PAGE, created by vma_new_page() and not yet
+ * claimed, may share its frame through the page cache: it has
+ * file contents at a page-aligned offset, and its mapping either
+ * is read-only or is private, so that it never writes to the
+ * frame.  If so, stores its key and how many bytes of it come
+ * from the file. */
+bool
+vma_cache_key (struct page *page, struct inode **inode, off_t *offset,
+		size_t *read_bytes) {
+	struct vma *vma = page->uninit.aux;
+	size_t ofs;
+
+	if (page->operations->type != VM_UNINIT
+			|| page->uninit.init != vma_load_page)
+		return false;
+	ofs = page->va - vma->start;
+	if (ofs >= vma->read_bytes || (vma->offset + ofs) % PGSIZE != 0
+			|| (VM_TYPE (vma->type) != VM_ANON && vma->writable))
+		return false;
+
+	*inode = file_get_inode (vma->file);
+	*offset = vma->offset + ofs;
+	*read_bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+	return true;
+}
+
+/* Returns true if PAGE, not yet touched, will be filled at
+ * least in part from its VMA's file. */
+bool
+vma_reads_file (struct page *page) {
+	struct vma *vma = page->uninit.aux;
+
+	return page->operations->type == VM_UNINIT
+		&& page->uninit.init == vma_load_page
+		&& vma->file != NULL && (size_t) (page->va - vma->start) < vma->read_bytes;
+}
+
+/* Initializes PAGE, for which vma_cache_key() or vma_shmem()
+ * returned true, as a page of its type without reading anything:
+ * its frame at KVA is shared from the page cache or from shared
+ * anonymous memory. */
+bool
+vma_init_cached_page (struct page *page, void *kva) {
+	struct uninit_page uninit = page->uninit;
+	struct vma *vma = uninit.aux;
+	size_t ofs = page->va - vma->start;
+
+	if (!uninit.page_initializer (page, uninit.type, kva))
+		return false;
+	vma_set_file (page, vma, ofs, vma->read_bytes - ofs < PGSIZE
+			? vma->read_bytes - ofs : PGSIZE);
+	return true;
+}
+
+/* Returns the shared anonymous memory that backs PAGE, created
+ * by vma_new_page() and not yet claimed, and stores through IDX
+ * the index of PAGE in it.  Returns a null pointer if PAGE's
+ * VMA is not shared. */
+struct shmem *
+vma_shmem (struct page *page, size_t *idx) {
+	struct vma *vma = page->uninit.aux;
+
+	if (page->operations->type != VM_UNINIT
+			|| page->uninit.init != vma_load_page || vma->shmem == NULL)
+		return NULL;
+	*idx = (page->va - vma->start) / PGSIZE;
+	return vma->shmem;
+}
+
+/* Gives DST, which must be empty, a copy of each VMA of SRC.
+ * Copies of shared VMAs share their memory with the original. */
+bool
+vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	ASSERT (dst->vma_root == NULL);
+
+	for (struct vma *vma = vma_next (src, NULL); vma != NULL;
+			vma = vma_next (src, vma->end)) {
+		struct vma *copy = vma_create (dst, vma->start, vma->end, vma->type,
+				vma->writable, vma->file, vma->offset, vma->read_bytes);
+		if (copy == NULL)
+			return false;
+		copy->advice = vma->advice;
+		if (vma->shmem != NULL)
+			copy->shmem = shmem_get (vma->shmem);
+		if (!thp_copy (copy, vma))
+			return false;
+	}
+	return true;
+}
+
+/* Destroys every VMA of SPT. */
+void
+vma_kill (struct supplemental_page_table *spt) {
+	while (spt->vma_root != NULL)
+		vma_destroy (spt, spt->vma_root);
+}
+
+/* Takes ADVICE, one of the MADV_* values, about the LENGTH
+ * bytes at ADDR, which must be page-aligned and all mapped.
+ *
+ * MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set how each VMA
+ * the range touches is read ahead.  Since VMAs are not split,
+ * they apply to the whole of it.  MADV_WILLNEED reads the range
+ * in.  MADV_DONTNEED unmaps it at once, discarding private
+ * anonymous contents and writing back file-backed ones; the
+ * pages are recreated from their VMA if touched again.
+ * MADV_FREE, for private anonymous memory only, lets resident
+ * pages be dropped rather than swapped out unless they are
+ * written first.
+ *
+ * Returns 0 on success, -1 on error. */
+int
+do_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+	void *end, *p;
+
+	if (pg_ofs (addr) != 0 || length == 0
+			|| (uintptr_t) addr + length < (uintptr_t) addr
+			|| advice < MADV_NORMAL || advice > MADV_FREE)
+		return -1;
+	end = pg_round_up (addr + length);
+	for (p = addr; p < end; p = vma->end) {
+		vma = vma_find (spt, p);
+		if (vma == NULL || (advice == MADV_FREE
+					&& (vma->file != NULL || vma->shmem != NULL)))
+			return -1;
+	}
+
+	for (p = addr; p < end; p = vma->end) {
+		void *vma_end;
+
+		vma = vma_find (spt, p);
+		vma_end = end < vma->end ? end : vma->end;
+		switch (advice) {
+			case MADV_NORMAL:
+			case MADV_RANDOM:
+			case MADV_SEQUENTIAL:
+				vma->advice = advice;
+				vma->ra_pages = 0;
+				break;
+			case MADV_WILLNEED:
+				vma_prefetch (vma, p, vma_end);
+				break;
+			case MADV_DONTNEED: {
+				struct mmu_gather tlb;
+
+				if (!thp_unmap_range (vma, p, vma_end))
+					return -1;
+				vm_unmap_begin (&tlb);
+				spt_remove_range (spt, p, vma_end);
+				vm_unmap_end (&tlb, p, vma_end);
+				break;
+			}
+			case MADV_FREE:
+				spt_for_each (spt, p, vma_end, vm_lazyfree_page, NULL);
+				break;
+		}
+	}
+	return 0;
+}
+
+/* Returns the current process's page at VA, creating it from
+ * the VMA that covers VA if need be, or a null pointer if VA is
+ * not mapped. */
+static struct page *
+vma_lookup_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+	struct vma *vma;
+
+	if (page == NULL && (vma = vma_find (spt, va)) != NULL)
+		page = vma_new_page (vma, va);
+	return page;
+}
+
+/* Adds to *NEW_CNT the number of pages of the current process
+ * in [START, END) that are not locked.  Returns false if part of
+ * the range is not mapped. */
+static bool
+mlock_count (struct supplemental_page_table *spt, void *start, void *end,
+		size_t *new_cnt) {
+	void *p;
+
+	for (p = start; p < end; p += PGSIZE) {
+		struct page *page = spt_find_page (spt, p);
+		if (page == NULL && vma_find (spt, p) == NULL)
+			return false;
+		if (page == NULL || !page->locked)
+			++*new_cnt;
+	}
+	return true;
+}
+
+/* Unlocks the pages of the current process in [START, END) that
+ * are not marked in WAS_LOCKED, which has a bit for each page of
+ * the range. */
+static void
+munlock_range (struct supplemental_page_table *spt, void *start, void *end,
+		const struct bitmap *was_locked) {
+	void *p;
+	size_t i;
+
+	for (p = start, i = 0; p < end; p += PGSIZE, i++) {
+		struct page *page = spt_find_page (spt, p);
+		if (page != NULL && !bitmap_test (was_locked, i))
+			vm_munlock_page (page);
+	}
+}
+
+/* Locks the pages of the current process in [START, END), which
+ * must be mapped, bringing them in first, and marks those that
+ * were locked already in WAS_LOCKED.  If a page cannot be brought
+ * in, unlocks again the pages it locked and returns false. */
+static bool
+mlock_range (struct supplemental_page_table *spt, void *start, void *end,
+		struct bitmap *was_locked) {
+	void *p;
+	size_t i;
+
+	for (p = start, i = 0; p < end; p += PGSIZE, i++) {
+		struct page *page = vma_lookup_page (spt, p);
+
+		if (page != NULL && page->locked)
+			bitmap_mark (was_locked, i);
+		else if (page == NULL || !vm_mlock_page (page)) {
+			munlock_range (spt, start, p, was_locked);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Locks the pages of the current process that overlap
+ * [ADDR, ADDR + LENGTH) in memory if LOCK is true, bringing
+ * them in first, or unlocks them if LOCK is false.  Locking
+ * fails, changing nothing, if it would take the process past
+ * mlock_page_limit locked pages or a page cannot be brought in;
+ * the pages it locked before finding that out are unlocked
+ * again, and those that were locked already stay locked.
+ *
+ * Returns 0 on success, -1 if part of the range is not mapped,
+ * the limit would be exceeded or memory is short. */
+int
+do_mlock (const void *addr, size_t length, bool lock) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct bitmap *was_locked;
+	size_t new_cnt = 0;
+	void *start, *end, *p;
+	bool success;
+
+	if (length == 0)
+		return 0;
+	if ((uintptr_t) addr + length < (uintptr_t) addr
+			|| !is_user_vaddr (addr + length - 1))
+		return -1;
+	start = pg_round_down (addr);
+	end = pg_round_up (addr + length);
+	if (!mlock_count (spt, start, end, &new_cnt))
+		return -1;
+
+	if (!lock) {
+		for (p = start; p < end; p += PGSIZE) {
+			struct page *page = spt_find_page (spt, p);
+			if (page != NULL)
+				vm_munlock_page (page);
+		}
+		return 0;
+	}
+	if (spt->locked_cnt + new_cnt > mlock_page_limit
+			|| (was_locked = bitmap_create ((end - start) / PGSIZE)) == NULL)
+		return -1;
+	success = mlock_range (spt, start, end, was_locked);
+	bitmap_destroy (was_locked);
+	return success ? 0 : -1;
+}
+
+/* Locks every page mapped by the current process, or none of
+ * them: returns false, leaving each page as it was, if that would
+ * take the process past mlock_page_limit locked pages or a page
+ * cannot be brought in. */
+static bool
+mlock_all (struct supplemental_page_table *spt) {
+	struct bitmap **was_locked;
+	size_t vma_cnt = 0, new_cnt = 0, done_cnt, i;
+	struct vma *vma;
+	void *p;
+
+	for (p = NULL; (vma = vma_next (spt, p)) != NULL; p = vma->end) {
+		mlock_count (spt, vma->start, vma->end, &new_cnt);
+		vma_cnt++;
+	}
+	if (vma_cnt == 0)
+		return true;
+	if (spt->locked_cnt + new_cnt > mlock_page_limit
+			|| (was_locked = calloc (vma_cnt, sizeof *was_locked)) == NULL)
+		return false;
+
+	/* Each VMA's record of the pages that were locked already is
+	 * kept until all of them are done, so that if one fails, the
+	 * ones before it can be unlocked again. */
+	for (p = NULL, done_cnt = 0; (vma = vma_next (spt, p)) != NULL;
+			p = vma->end, done_cnt++) {
+		was_locked[done_cnt] = bitmap_create ((vma->end - vma->start) / PGSIZE);
+		if (was_locked[done_cnt] == NULL
+				|| !mlock_range (spt, vma->start, vma->end,
+					was_locked[done_cnt]))
+			break;
+	}
+	for (p = NULL, i = 0; i < vma_cnt; p = vma->end, i++) {
+		vma = vma_next (spt, p);
+		if (done_cnt < vma_cnt && i < done_cnt)
+			munlock_range (spt, vma->start, vma->end, was_locked[i]);
+		bitmap_destroy (was_locked[i]);
+	}
+	free (was_locked);
+	return done_cnt == vma_cnt;
+}
+
+/* Locks every page currently mapped by the current process if
+ * FLAGS includes MCL_CURRENT, and arranges for pages touched
+ * from now on to be locked as they are brought in if FLAGS
+ * includes MCL_FUTURE.  Like mlock(), locking fails if it would
+ * take the process past mlock_page_limit locked pages or a page
+ * cannot be brought in, and then leaves every VMA as it was.
+ * Returns 0 on success, -1 on error. */
+int
+do_mlockall (int flags) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+
+	if (flags == 0 || (flags & ~(MCL_CURRENT | MCL_FUTURE)) != 0)
+		return -1;
+	if ((flags & MCL_CURRENT) && !mlock_all (spt))
+		return -1;
+	spt->mlock_future = (flags & MCL_FUTURE) != 0;
+	return 0;
+}
+
+/* Prints readahead statistics. */
+void
+vma_print_stats (void) {
+	printf ("VM: %"PRIu64" file pages read ahead\n", readahead_cnt);
+}
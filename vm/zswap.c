@@ -0,0 +1,355 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk.
+ *
+ * Writing a page to the swap disk takes eight sector transfers
+ * and reading it back as many again.  When enabled, anonymous
+ * pages being swapped out are instead compressed and kept in a
+ * pool of kernel pages; only pages that do not compress well,
+ * or that find the pool full, go to the disk.
+ *
+ * Pages are compressed with a small LZ77 compressor using the
+ * LZ4 block layout: a sequence of literal runs, each followed
+ * by a back-reference of at least MIN_MATCH bytes.
+ *
+ * The pool is managed like Linux's zbud: each pool page holds at
+ * most two compressed pages, one growing up from just after the
+ * header and one growing down from the end.  That caps the
+ * compression gain at 2:1, but allocation and freeing are O(1)
+ * and pool pages never need compacting. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+size_t zswap_page_limit;
+
+/* Compressor. */
+#define MIN_MATCH 4                     /* Shortest back-reference. */
+#define HASH_BITS 12                    /* Log2 of match table size. */
+#define RUN_MASK 15                     /* Length that needs extending. */
+
+/* Pool. */
+#define ZCHUNK 64                       /* Allocation granularity. */
+#define ZMAX_LEN (PGSIZE * 3 / 4)       /* Largest length worth keeping. */
+
+/* A page of the pool. */
+struct zpage {
+	struct list_elem elem;              /* In unbuddied if half full. */
+	uint16_t first_len;                 /* Length at the start, or 0. */
+	uint16_t last_len;                  /* Length at the end, or 0. */
+};
+
+#define ZPAGE_HDR ROUND_UP (sizeof (struct zpage), ZCHUNK)
+
+/* A compressed page. */
+struct zswap_entry {
+	struct zpage *zpage;                /* Pool page holding it. */
+	uint16_t len;                       /* Compressed length. */
+	bool last;                          /* At the end of ZPAGE? */
+};
+
+static struct lock zswap_lock;          /* Protects everything below. */
+static struct list unbuddied;           /* Pool pages with room. */
+static size_t pool_pages;               /* Pages in the pool. */
+static uint16_t match_table[1 << HASH_BITS];
+static uint8_t scratch[PGSIZE];         /* Compression output. */
+
+/* Statistics. */
+static uint64_t store_cnt;              /* Pages stored. */
+static uint64_t load_cnt;               /* Pages loaded back. */
+static uint64_t reject_cnt;             /* Pages that did not compress. */
+static uint64_t full_cnt;               /* Pages turned away, pool full. */
+static uint64_t stored_bytes;           /* Compressed size of stores. */
+static size_t pool_pages_max;           /* High-water mark of the pool. */
+
+/* Initializes the compressed pool. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	list_init (&unbuddied);
+}
+
+/* Returns true if the compressed pool is in use. */
+bool
+zswap_enabled (void) {
+	return zswap_page_limit > 0;
+}
+
+static inline uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Appends LEN, less the RUN_MASK already stored in a token, to
+ * *OP as a run of 255s and a final byte. */
+static uint8_t *
+put_length (uint8_t *op, size_t len) {
+	for (len -= RUN_MASK; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Appends to *OP a sequence of LIT_LEN literals from LIT
+ * followed, if MATCH_LEN is nonzero, by a back-reference of
+ * MATCH_LEN bytes at distance OFFSET.  Returns false if it would
+ * not fit before OP_END. */
+static bool
+put_sequence (uint8_t **opp, const uint8_t *op_end, const uint8_t *lit,
+		size_t lit_len, size_t offset, size_t match_len) {
+	uint8_t *op = *opp;
+	size_t lit_code = lit_len < RUN_MASK ? lit_len : RUN_MASK;
+	size_t match_code = 0;
+
+	if (match_len > 0) {
+		match_len -= MIN_MATCH;
+		match_code = match_len < RUN_MASK ? match_len : RUN_MASK;
+	}
+	if ((size_t) (op_end - op) < 1 + lit_len / 255 + 1 + lit_len
+			+ 2 + match_len / 255 + 1)
+		return false;
+
+	*op++ = (lit_code << 4) | match_code;
+	if (lit_code == RUN_MASK)
+		op = put_length (op, lit_len);
+	memcpy (op, lit, lit_len);
+	op += lit_len;
+	if (offset > 0) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (match_code == RUN_MASK)
+			op = put_length (op, match_len);
+	}
+	*opp = op;
+	return true;
+}
+
+/* Compresses the page at SRC into DST, which has room for
+ * DST_MAX bytes.  Returns the compressed length, or 0 if it
+ * would exceed DST_MAX. */
+static size_t
+compress (const uint8_t *src, uint8_t *dst, size_t dst_max) {
+	const uint8_t *ip = src, *anchor = src;
+	const uint8_t *const end = src + PGSIZE;
+	uint8_t *op = dst;
+
+	memset (match_table, 0, sizeof match_table);
+	while (ip + MIN_MATCH <= end) {
+		uint32_t seq = read32 (ip);
+		unsigned h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		const uint8_t *ref = src + match_table[h];
+		const uint8_t *mp, *rp;
+
+		match_table[h] = ip - src;
+		if (ref >= ip || read32 (ref) != seq) {
+			ip++;
+			continue;
+		}
+		for (mp = ip + MIN_MATCH, rp = ref + MIN_MATCH; mp < end && *mp == *rp;
+				mp++, rp++)
+			continue;
+		if (!put_sequence (&op, dst + dst_max, anchor, ip - anchor, ip - ref,
+					mp - ip))
+			return 0;
+		ip = anchor = mp;
+	}
+	if (!put_sequence (&op, dst + dst_max, anchor, end - anchor, 0, 0))
+		return 0;
+	return op - dst;
+}
+
+/* Reads a length extension from *IPP and adds it to LEN. */
+static size_t
+get_length (const uint8_t **ipp, size_t len) {
+	uint8_t b;
+	do {
+		b = *(*ipp)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+/* Decompresses the LEN bytes at SRC, produced by compress(),
+ * into the page at DST. */
+static void
+decompress (const uint8_t *src, size_t len, uint8_t *dst) {
+	const uint8_t *ip = src, *const end = src + len;
+	uint8_t *op = dst;
+
+	for (;;) {
+		unsigned token = *ip++;
+		size_t lit_len = token >> 4, match_len, offset;
+
+		if (lit_len == RUN_MASK)
+			lit_len = get_length (&ip, lit_len);
+		memcpy (op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip >= end)
+			break;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		match_len = token & RUN_MASK;
+		if (match_len == RUN_MASK)
+			match_len = get_length (&ip, match_len);
+		match_len += MIN_MATCH;
+		ASSERT (offset > 0 && offset <= (size_t) (op - dst));
+		for (; match_len > 0; match_len--, op++)
+			*op = op[-offset];
+	}
+	ASSERT (op == dst + PGSIZE);
+}
+
+/* Returns the free space in ZPAGE. */
+static size_t
+zpage_free (const struct zpage *zpage) {
+	return PGSIZE - ZPAGE_HDR - ROUND_UP (zpage->first_len, ZCHUNK)
+		- ROUND_UP (zpage->last_len, ZCHUNK);
+}
+
+static uint8_t *
+entry_data (const struct zswap_entry *entry) {
+	uint8_t *base = (uint8_t *) entry->zpage;
+	return entry->last ? base + PGSIZE - entry->len : base + ZPAGE_HDR;
+}
+
+/* Places ENTRY, whose LEN is set, in the pool.  Returns false if
+ * that would need a new pool page and the pool is at its limit
+ * or the kernel is out of pages.
+ *
+ * A pool page is on unbuddied exactly when one of its two slots
+ * is in use, whichever that is. */
+static bool
+pool_alloc (struct zswap_entry *entry) {
+	struct list_elem *e;
+	struct zpage *zpage = NULL;
+
+	for (e = list_begin (&unbuddied); e != list_end (&unbuddied);
+			e = list_next (e)) {
+		struct zpage *z = list_entry (e, struct zpage, elem);
+		if (zpage_free (z) >= (size_t) ROUND_UP (entry->len, ZCHUNK)) {
+			zpage = z;
+			list_remove (&zpage->elem);
+			break;
+		}
+	}
+
+	if (zpage == NULL) {
+		if (pool_pages >= zswap_page_limit
+				|| (zpage = palloc_get_page (0)) == NULL)
+			return false;
+		zpage->first_len = zpage->last_len = 0;
+		if (++pool_pages > pool_pages_max)
+			pool_pages_max = pool_pages;
+	}
+
+	entry->zpage = zpage;
+	entry->last = zpage->first_len != 0;
+	if (entry->last)
+		zpage->last_len = entry->len;
+	else
+		zpage->first_len = entry->len;
+	if (zpage->first_len == 0 || zpage->last_len == 0)
+		list_push_back (&unbuddied, &zpage->elem);
+	return true;
+}
+
+/* Removes ENTRY from the pool. */
+static void
+pool_free (struct zswap_entry *entry) {
+	struct zpage *zpage = entry->zpage;
+	bool was_full = zpage->first_len != 0 && zpage->last_len != 0;
+
+	if (entry->last)
+		zpage->last_len = 0;
+	else
+		zpage->first_len = 0;
+
+	if (zpage->first_len == 0 && zpage->last_len == 0) {
+		list_remove (&zpage->elem);
+		palloc_free_page (zpage);
+		pool_pages--;
+	} else if (was_full)
+		list_push_back (&unbuddied, &zpage->elem);
+}
+
+/* Compresses the page at PAGE into the pool.  Returns the new
+ * entry, or a null pointer if the pool is disabled or full or
+ * the page does not compress well enough to be worth keeping. */
+struct zswap_entry *
+zswap_store (const void *page) {
+	struct zswap_entry *entry;
+	size_t len;
+
+	if (!zswap_enabled ())
+		return NULL;
+	entry = malloc (sizeof *entry);
+	if (entry == NULL)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	len = compress (page, scratch, ZMAX_LEN);
+	if (len == 0) {
+		reject_cnt++;
+		goto fail;
+	}
+	entry->len = len;
+	if (!pool_alloc (entry)) {
+		full_cnt++;
+		goto fail;
+	}
+	memcpy (entry_data (entry), scratch, len);
+	store_cnt++;
+	stored_bytes += len;
+	lock_release (&zswap_lock);
+	return entry;
+
+fail:
+	lock_release (&zswap_lock);
+	free (entry);
+	return NULL;
+}
+
+/* Decompresses ENTRY into the page at PAGE and frees it. */
+void
+zswap_load (struct zswap_entry *entry, void *page) {
+	lock_acquire (&zswap_lock);
+	decompress (entry_data (entry), entry->len, page);
+	load_cnt++;
+	lock_release (&zswap_lock);
+	zswap_free (entry);
+}
+
+/* Frees ENTRY without reading it. */
+void
+zswap_free (struct zswap_entry *entry) {
+	lock_acquire (&zswap_lock);
+	pool_free (entry);
+	lock_release (&zswap_lock);
+	free (entry);
+}
+
+/* Prints compressed pool statistics. */
+void
+zswap_print_stats (void) {
+	if (!zswap_enabled ())
+		return;
+	printf ("zswap: %"PRIu64" stored, %"PRIu64" loaded, "
+			"%"PRIu64" incompressible, %"PRIu64" pool full\n",
+			store_cnt, load_cnt, reject_cnt, full_cnt);
+	printf ("zswap: compressed to %"PRIu64"%% of original, "
+			"pool %zu pages (max %zu of %zu)\n",
+			store_cnt > 0 ? stored_bytes * 100 / (store_cnt * PGSIZE) : 0,
+			pool_pages, pool_pages_max, zswap_page_limit);
+}